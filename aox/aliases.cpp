@@ -187,6 +187,7 @@ void CreateAlias::execute()
         error( "Internal error: Inserted " + fn( d->q->rows() ) +
                " instead of 1. Not committing." );
 
+    d->t->enqueue( new Query( "notify aliases_updated", 0 ) );
     d->t->commit();
 
     finish();
@@ -207,7 +208,7 @@ f3( "delete", "alias", "Delete a delivery alias.",
 */
 
 DeleteAlias::DeleteAlias( EStringList * args )
-    : AoxCommand( args ), q( 0 )
+    : AoxCommand( args ), q( 0 ), t( 0 )
 {
 }
 
@@ -241,14 +242,17 @@ void DeleteAlias::execute()
             q->bind( 3, target->localpart() );
             q->bind( 4, target->domain() );
         }
-        q->execute();
+        t = new Transaction( this );
+        t->enqueue( q );
+        t->enqueue( new Query( "notify aliases_updated", 0 ) );
+        t->commit();
     }
 
-    if ( !q->done() )
+    if ( !t->done() )
         return;
 
-    if ( q->failed() )
-        error( "Couldn't delete alias: " + q->error() );
+    if ( t->failed() )
+        error( "Couldn't delete alias: " + t->error() );
 
     finish();
 }
@@ -15,6 +15,7 @@ public:
 
 private:
     class Query * q;
+    class Transaction * t;
 };
 
 
@@ -39,6 +40,7 @@ public:
 
 private:
     class Query * q;
+    class Transaction * t;
 };
 
 
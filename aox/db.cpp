@@ -273,6 +273,8 @@ void Vacuum::execute()
             t->enqueue(
                 "delete from addresses where id in "
                 "(select address from au where not used)" );
+            // servers must not keep using the IDs we just deleted
+            t->enqueue( "notify addresses_deleted" );
             // the index has to go away again
             t->enqueue( "drop table au" );
             t->enqueue( "drop index af_a" );
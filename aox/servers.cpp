@@ -312,6 +312,8 @@ static void checkFilePermissions()
 
     if ( Configuration::text( Configuration::MessageCopy ).lower() != "none" )
         addPath( Path::WritableDir, Configuration::MessageCopyDir );
+    if ( !Configuration::text( Configuration::SpoolDirectory ).isEmpty() )
+        addPath( Path::WritableDir, Configuration::SpoolDirectory );
     addPath( Path::JailDir, Configuration::JailDir );
     if ( Configuration::toggle( Configuration::UseTls ) ) {
         EString c = Configuration::text( Configuration::TlsCertFile );
@@ -338,6 +340,7 @@ static void checkFilePermissions()
         EString s( Configuration::text( *it ) );
         if ( s[0] == '/' &&
              ( *it == Configuration::DbAddress ||
+               *it == Configuration::DbReplicaAddress ||
                *it == Configuration::SmartHostAddress ) )
             addPath( Path::ExistingSocket, *it );
         else if ( s[0] == '/' )
@@ -528,6 +531,13 @@ static void checkMiscellaneous()
         }
     }
 
+    EString sd( Configuration::text( Configuration::SpoolDirectory ) );
+    if ( !sd.isEmpty() ) {
+        struct stat st;
+        if ( ::stat( sd.cstr(), &st ) < 0 || !S_ISDIR( st.st_mode ) )
+            error( "spool-directory is not a directory" );
+    }
+
     if ( !Configuration::toggle( Configuration::UseTls ) ) {
         if ( Configuration::toggle( Configuration::UseImaps ) )
             error( "use-imaps enabled, but use-tls disabled" );
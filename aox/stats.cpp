@@ -76,6 +76,7 @@ void ShowCounts::execute()
         );
 
         d->query->bind( 1, s );
+        d->query->setReadOnly( true );
         d->query->execute();
     }
 
@@ -111,6 +112,7 @@ void ShowCounts::execute()
                        "as mm, "
                        "(select count(*) from deleted_messages)::int "
                        "as dm from messages", this );
+        d->query->setReadOnly( true );
         d->query->execute();
         d->state = 2;
     }
@@ -140,6 +142,7 @@ void ShowCounts::execute()
                        "coalesce(sum(length(text))::bigint,0) as textsize,"
                        "coalesce(sum(length(data))::bigint,0) as datasize "
                        "from bodyparts", this );
+        d->query->setReadOnly( true );
         d->query->execute();
         d->state = 3;
     }
@@ -160,6 +163,7 @@ void ShowCounts::execute()
         d->query =
             new Query( "select count(*)::int as addresses "
                        "from addresses", this );
+        d->query->setReadOnly( true );
         d->query->execute();
         d->state = 4;
     }
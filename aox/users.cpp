@@ -494,6 +494,7 @@ void ChangeUsername::execute()
         q->bind( 1, d->user->id() );
         q->bind( 2, d->newname );
         d->t->enqueue( q );
+        d->t->enqueue( new Query( "notify users_updated", 0 ) );
 
         d->query =
             new Query( "select name from mailboxes where deleted='f' and "
@@ -643,6 +644,7 @@ void ChangeAddress::execute()
         d->query->bind( 1, d->user->id() );
         d->query->bind( 2, d->address->id() );
         d->t->enqueue( d->query );
+        d->t->enqueue( new Query( "notify aliases_updated", 0 ) );
         d->t->commit();
     }
 
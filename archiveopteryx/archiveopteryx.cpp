@@ -158,6 +158,17 @@ int main( int argc, char *argv[] )
     }
 
 
+    EString sd( Configuration::text( Configuration::SpoolDirectory ) );
+    if ( !sd.isEmpty() ) {
+        struct stat st;
+        if ( ::stat( sd.cstr(), &st ) < 0 || !S_ISDIR( st.st_mode ) )
+            log( "Inaccessible spool-directory: " + sd, Log::Disaster );
+        else if ( security && !sd.startsWith( root ) )
+            log( "spool-directory must be under jail directory " + root,
+                 Log::Disaster );
+    }
+
+
     EString sA( Configuration::text( Configuration::SmartHostAddress ) );
     uint sP( Configuration::scalar( Configuration::SmartHostPort ) );
 
@@ -281,6 +292,10 @@ int main( int argc, char *argv[] )
         "Statistics", Configuration::toggle( Configuration::UseStatistics ),
         Configuration::StatisticsAddress, Configuration::StatisticsPort
     );
+    Listener< MetricsServer >::create(
+        "Metrics", Configuration::toggle( Configuration::UseStatistics ),
+        Configuration::StatisticsAddress, Configuration::MetricsPort
+    );
 
     EventLoop::global()->setMemoryUsage(
         1024 * 1024 * Configuration::scalar( Configuration::MemoryLimit ) );
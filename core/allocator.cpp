@@ -227,6 +227,13 @@ static struct {
 
 static uint numRoots;
 
+static struct Mapping {
+    char * base;
+    uint size;
+    bool marked;
+    Mapping * next;
+} * mappings;
+
 static bool verbose;
 
 
@@ -455,6 +462,43 @@ void Allocator::setNumPointers( const void * p, uint n )
 }
 
 
+/*! This private helper marks the region added by addMapping() which
+    contains \a p, if there is one. mark() calls it for each pointer
+    that doesn't point to memory it manages.
+*/
+
+void Allocator::markMapping( void * p )
+{
+    Mapping * m = ::mappings;
+    while ( m ) {
+        if ( (char*)p >= m->base && (char*)p < m->base + m->size ) {
+            m->marked = true;
+            return;
+        }
+        m = m->next;
+    }
+}
+
+
+/*! Records that the \a size bytes at \a base are a region created
+    using mmap(), which Garbage (typically EString::readOnly() and its
+    mid()s) may point into. free() calls munmap() for the region as
+    soon as nothing points into it any more.
+*/
+
+void Allocator::addMapping( void * base, uint size )
+{
+    Mapping * m = (Mapping*)malloc( sizeof( Mapping ) );
+    if ( !m )
+        die( Memory );
+    m->base = (char*)base;
+    m->size = size;
+    m->marked = false;
+    m->next = ::mappings;
+    ::mappings = m;
+}
+
+
 /*! This private helper checks that \a p is a valid pointer to
     unmarked GCable memory, marks it, and puts it on a stack so that
     mark() can process it and add its children to the stack.
@@ -464,12 +508,16 @@ void Allocator::mark( void * p )
 {
     Allocator * a = AllocatorMapTable::find( p );
     // a may be the allocator we want. does its area encompass p?
-    if ( !a || (ulong)a->buffer > (ulong)p )
+    if ( !a || (ulong)a->buffer > (ulong)p ) {
+        markMapping( p );
         return;
+    }
     // perhaps, but let's look closer
     ulong i = ((ulong)p - (ulong)a->buffer) / a->step;
-    if ( i >= a->capacity )
+    if ( i >= a->capacity ) {
+        markMapping( p );
         return;
+    }
     if ( ! (a->used[i/bits] & 1UL << (i%bits)) )
         return;
     // fine. we have the block of memory.
@@ -561,6 +609,12 @@ Garbage * Allocator::free( List<Garbage> * entries )
 
     Garbage * biggest = 0;
 
+    Mapping * m = ::mappings;
+    while ( m ) {
+        m->marked = false;
+        m = m->next;
+    }
+
     // mark
     if ( entries ) {
         uint size = 0;
@@ -591,6 +645,20 @@ Garbage * Allocator::free( List<Garbage> * entries )
     }
     gettimeofday( &afterMark, 0 );
 
+    // unmap the regions noone points into any more
+    Mapping ** mp = &::mappings;
+    while ( *mp ) {
+        m = *mp;
+        if ( m->marked ) {
+            mp = &m->next;
+        }
+        else {
+            *mp = m->next;
+            ::munmap( m->base, m->size );
+            ::free( m );
+        }
+    }
+
     // and sweep
     i = 0;
     uint blocks = 0;
@@ -28,6 +28,8 @@ public:
 
     static void setReporting( bool );
 
+    static void addMapping( void *, uint );
+
     static uint allocated();
     static uint inUse();
 
@@ -63,6 +65,7 @@ private:
 private:
     static void mark( void * );
     static void mark();
+    static void markMapping( void * );
     void sweep();
 };
 
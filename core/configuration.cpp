@@ -164,7 +164,22 @@ static struct {
     { "smarthost-port", Configuration::SmartHostPort, 25 },
     { "statistics-port", Configuration::StatisticsPort, 17220 },
     { "ldap-server-port", Configuration::LdapServerPort, 390 },
-    { "memory-limit", Configuration::MemoryLimit, 64 }
+    { "memory-limit", Configuration::MemoryLimit, 64 },
+    { "rfc822-cache-size", Configuration::Rfc822CacheSize, 0 },
+    { "spool-threshold", Configuration::SpoolThreshold, 1024 },
+    { "injection-group-size", Configuration::InjectionGroupSize, 32 },
+    { "smarthost-connections", Configuration::SmartHostConnections, 4 },
+    { "slow-query-threshold", Configuration::SlowQueryThreshold, 1000 },
+    { "metrics-port", Configuration::MetricsPort, 17221 },
+    { "db-interactive-handles", Configuration::DbInteractiveHandles, 1 },
+    { "db-min-handles", Configuration::DbMinHandles, 2 },
+    { "db-replica-port", Configuration::DbReplicaPort, 5432 },
+    { "db-replica-handles", Configuration::DbReplicaHandles, 2 },
+    { "db-interactive-timeout", Configuration::DbInteractiveTimeout, 0 },
+    { "db-delivery-timeout", Configuration::DbDeliveryTimeout, 0 },
+    { "db-background-timeout", Configuration::DbBackgroundTimeout, 0 },
+    { "slow-callback-threshold", Configuration::SlowCallbackThreshold, 100 },
+    { "callback-sample-interval", Configuration::CallbackSampleInterval, 100 }
 };
 
 
@@ -211,7 +226,9 @@ static struct {
     { "smarthost-address", Configuration::SmartHostAddress, "127.0.0.1" },
     { "address-separator", Configuration::AddressSeparator, "" },
     { "statistics-address", Configuration::StatisticsAddress, "127.0.0.1" },
-    { "ldap-server-address", Configuration::LdapServerAddress, "127.0.0.1" }
+    { "ldap-server-address", Configuration::LdapServerAddress, "127.0.0.1" },
+    { "spool-directory", Configuration::SpoolDirectory, "" },
+    { "db-replica-address", Configuration::DbReplicaAddress, "" }
 };
 
 
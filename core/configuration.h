@@ -57,6 +57,21 @@ public:
         StatisticsPort,
         LdapServerPort,
         MemoryLimit,
+        Rfc822CacheSize,
+        SpoolThreshold,
+        InjectionGroupSize,
+        SmartHostConnections,
+        SlowQueryThreshold,
+        MetricsPort,
+        DbInteractiveHandles,
+        DbMinHandles,
+        DbReplicaPort,
+        DbReplicaHandles,
+        DbInteractiveTimeout,
+        DbDeliveryTimeout,
+        DbBackgroundTimeout,
+        SlowCallbackThreshold,
+        CallbackSampleInterval,
         // additional scalars go ABOVE THIS LINE
         NumScalars
     };
@@ -102,6 +117,8 @@ public:
         AddressSeparator,
         StatisticsAddress,
         LdapServerAddress,
+        SpoolDirectory,
+        DbReplicaAddress,
         // additional texts go ABOVE THIS LINE
         NumTexts
     };
@@ -563,6 +563,28 @@ EString EString::mid( uint start, uint num ) const
 }
 
 
+/*! Returns a read-only string whose data are the \a num bytes at \a
+    s. The data are not copied, so \a s must remain valid as long as
+    the string (or a mid() of it) exists. Any function which modifies
+    the string copies the data first.
+
+    This is meant for data that isn't on the heap, such as a file
+    region registered using Allocator::addMapping().
+*/
+
+EString EString::readOnly( const char * s, uint num )
+{
+    EString result;
+    if ( !num )
+        return result;
+
+    result.d = new EStringData;
+    result.d->str = (char*)s;
+    result.d->len = num;
+    return result;
+}
+
+
 /*! Returns true is the string is quoted with \a c (default '"') as
     quote character and \a q (default '\') as escape character. \a c
     and \a q may be the same. */
@@ -1162,6 +1184,19 @@ static char from64[128] =
 
 
 
+/*! Returns the value of the base-64 digit \a c, 64 for '=' and NUL,
+    65 for whitespace, and 99 for anything else. All of the special
+    values have bit 6 set.
+*/
+
+static inline uint value64( unsigned char c )
+{
+    if ( c > 'z' )
+        return 99;
+    return from64[c];
+}
+
+
 /*! Decodes this string using the base-64 algorithm and returns the result. */
 
 EString EString::de64() const
@@ -1169,16 +1204,35 @@ EString EString::de64() const
     // this code comes from mailchen, adapted for EString.
     EString result;
     result.reserve( length() * 3 / 4 + 20 ); // 20 = fudge
-    EString body;
     uint bp = 0;
     uint decoded = 0;
     int m = 0;
     uint p = 0;
     bool done = false;
-    while ( p < length() && !done ) {
-        uint c = d->str[p++];
-        if ( c <= 'z' )
-            c = from64[c];
+    const uint l = length();
+    const unsigned char * s = (const unsigned char *)( l ? d->str : 0 );
+    while ( p < l && !done ) {
+        if ( m == 0 ) {
+            // almost all the input consists of whole groups of four
+            // digits, which we can decode in one go. the slow path
+            // below handles whitespace, junk and the end.
+            while ( p + 4 <= l ) {
+                uint a = value64( s[p] );
+                uint b = value64( s[p+1] );
+                uint c = value64( s[p+2] );
+                uint e = value64( s[p+3] );
+                if ( ( a | b | c | e ) & 64 )
+                    break;
+                uint n = ( a << 18 ) | ( b << 12 ) | ( c << 6 ) | e;
+                result.d->str[bp++] = n >> 16;
+                result.d->str[bp++] = n >> 8;
+                result.d->str[bp++] = n;
+                p += 4;
+            }
+            if ( p >= l )
+                break;
+        }
+        uint c = value64( s[p++] );
         if ( c < 64 ) {
             switch ( m ) {
             case 0:
@@ -1236,11 +1290,13 @@ EString EString::e64( uint lineLength ) const
     r.reserve( l*2 );
     int p = 0;
     uint c = 0;
+    const unsigned char * s = (const unsigned char *)( l ? d->str : 0 );
     while ( i <= l-3 ) {
-        r.d->str[p++] = to64[ ((d->str[i]>>2))&63 ];
-        r.d->str[p++] = to64[ ((d->str[i]<<4)&48) + ((d->str[i+1]>>4)&15) ];
-        r.d->str[p++] = to64[ ((d->str[i+1]<<2)&60) + ((d->str[i+2]>>6)&3) ];
-        r.d->str[p++] = to64[ (d->str[i+2]&63) ];
+        uint n = ( s[i] << 16 ) | ( s[i+1] << 8 ) | s[i+2];
+        r.d->str[p++] = to64[ n >> 18 ];
+        r.d->str[p++] = to64[ ( n >> 12 ) & 63 ];
+        r.d->str[p++] = to64[ ( n >> 6 ) & 63 ];
+        r.d->str[p++] = to64[ n & 63 ];
         i += 3;
         c += 4;
         if ( lineLength > 0 && c >= lineLength ) {
@@ -1274,6 +1330,30 @@ EString EString::e64( uint lineLength ) const
 }
 
 
+/*! Returns the value of the hexadecimal digit \a c, or -1 if \a c
+    isn't one. This does exactly what number( ok, 16 ) does for a
+    single character, including accepting a few punctuation
+    characters as digits, so that deQP() decodes broken input the same
+    way as it always has.
+*/
+
+static inline int hexValue( char c )
+{
+    uint n = (unsigned char)c;
+    if ( n < '0' || n > 'z' )
+        return -1;
+    uint digit = n - '0';
+    if ( digit > 9 ) {
+        if ( n > 'Z' )
+            n = n - 32;
+        digit = n - 'A' + 10;
+    }
+    if ( digit >= 16 )
+        return -1;
+    return digit;
+}
+
+
 /*! Decodes this string according to the quoted-printable algorithm,
     and returns the result. Errors are overlooked, to cope with all
     the mail-munging brokenware in the great big world.
@@ -1289,10 +1369,22 @@ EString EString::deQP( bool underscore ) const
     r.reserve( length() );
     while ( i < length() ) {
         if ( d->str[i] != '=' ) {
-            char c = d->str[i++];
-            if ( underscore && c == '_' )
-                c = ' ';
-            r.d->str[r.d->len++] = c;
+            // copy everything up to the next = in one go
+            const char * e = (const char *)memchr( d->str + i, '=',
+                                                   d->len - i );
+            uint n = e ? e - d->str : d->len;
+            char * o = r.d->str + r.d->len;
+            memmove( o, d->str + i, n - i );
+            if ( underscore ) {
+                uint j = 0;
+                while ( j < n - i ) {
+                    if ( o[j] == '_' )
+                        o[j] = ' ';
+                    j++;
+                }
+            }
+            r.d->len += n - i;
+            i = n;
         }
         else {
             // are we looking at = followed by end-of-line?
@@ -1315,7 +1407,12 @@ EString EString::deQP( bool underscore ) const
             }
             else if ( i + 2 < d->len ) {
                 // ... and one common case: a two-digit hex number, not EOL
-                c = mid( i+1, 2 ).number( &ok, 16 );
+                int h = hexValue( d->str[i+1] );
+                int l = hexValue( d->str[i+2] );
+                if ( h >= 0 && l >= 0 ) {
+                    ok = true;
+                    c = h * 16 + l;
+                }
             }
 
             // write the proper decoded string and increase i.
@@ -1338,6 +1435,16 @@ EString EString::deQP( bool underscore ) const
 static char qphexdigits[17] = "0123456789ABCDEF";
 
 
+/*! Returns true if \a c can be used as-is in (non-RFC 2047)
+    quoted-printable, and false if it has to be encoded.
+*/
+
+static inline bool qpLiteral( unsigned char c )
+{
+    return ( c >= ' ' && c < 127 && c != '=' ) || c == '\t';
+}
+
+
 static bool maybeBoundary( const EString & s, uint i ) {
     if ( s.length() < i + 2 )
         return false;
@@ -1405,6 +1512,20 @@ EString EString::eQP( bool underscore, bool from ) const
     r.reserve( length()*6 );
     uint c = 0;
     while ( i < d->len ) {
+        if ( !underscore && ( c > 0 || !from ) && c <= 72 &&
+             qpLiteral( d->str[i] ) ) {
+            // the common case: copy a run of characters that need
+            // neither quoting nor a soft line break.
+            uint n = i;
+            while ( n < d->len && c <= 72 && qpLiteral( d->str[n] ) ) {
+                c++;
+                n++;
+            }
+            memmove( r.d->str + r.d->len, d->str + i, n - i );
+            r.d->len += n - i;
+            i = n;
+            continue;
+        }
         if ( d->str[i] == 10 ||
              ( i < d->len-1 && d->str[i] == 13 && d->str[i+1] == 10 ) ) {
             // we have a line feed. if the last character on the line
@@ -1469,9 +1590,7 @@ EString EString::eQP( bool underscore, bool from ) const
                 r.d->str[r.d->len++] = qphexdigits[d->str[i]%16];
                 c += 3;
             }
-            else if ( ( d->str[i] >= ' ' && d->str[i] < 127 &&
-                        d->str[i] != '=' ) ||
-                      ( d->str[i] == '\t' ) ) {
+            else if ( qpLiteral( d->str[i] ) ) {
                 r.d->str[r.d->len++] = d->str[i];
                 c++;
             }
@@ -85,6 +85,7 @@ public:
     static EString fromNumber( int64, uint = 10 );
     void appendNumber( int64, uint = 10 );
     static EString humanNumber( int64 );
+    static EString readOnly( const char *, uint );
 
     int find( char, int=0 ) const;
     int find( const EString &, int=0 ) const;
@@ -169,6 +169,24 @@ bool Log::isChildOf( Log * other ) const
 }
 
 
+/*! Returns true if messages of severity \a s will be logged, and
+    false if log() would discard them.
+
+    Callers can use this to avoid constructing messages that would be
+    discarded, e.g. debug messages in frequently used code:
+
+    \code
+    if ( Log::enabled( Log::Debug ) )
+        log( "Considered " + fn( n ) + " messages", Log::Debug );
+    \endcode
+*/
+
+bool Log::enabled( Severity s )
+{
+    return s >= logLevel;
+}
+
+
 /*! Sets \a s as the minimum severity messages must have to be logged.
 */
 
@@ -0,0 +1,289 @@
+// Copyright 2009 The Archiveopteryx Developers <info@aox.org>
+
+#include "spoolfile.h"
+
+#include "configuration.h"
+#include "allocator.h"
+#include "file.h"
+#include "log.h"
+
+// open, O_RDWR etc.
+#include <fcntl.h>
+// write, pread, close, unlink, getpid
+#include <unistd.h>
+// mmap
+#include <sys/mman.h>
+// errno
+#include <errno.h>
+
+// we want large file support if available, but don't care
+#if !defined(O_LARGEFILE)
+#define O_LARGEFILE 0
+#endif
+
+
+// data is written to disk in chunks of at least this size
+static const uint writeSize = 65536;
+
+static uint counter = 0;
+
+
+class SpoolFileData
+    : public Garbage
+{
+public:
+    SpoolFileData(): fd( -1 ), size( 0 ), written( 0 ) {}
+
+    int fd;
+    uint size;
+    uint written;
+    EString pending;
+    EString contents;
+};
+
+
+/*! \class SpoolFile spoolfile.h
+
+    The SpoolFile class collects a potentially large amount of data,
+    such as an APPEND literal or the body of an SMTP DATA command,
+    without keeping it all in RAM while it arrives.
+
+    Data are append()ed to a string in RAM at first. Once size()
+    exceeds threshold(), the data are written to an unlinked file in
+    the spool-directory instead, and more is written there as it
+    arrives. When all the data have arrived, contents() maps the file
+    into memory and returns a read-only EString backed by the file, so
+    that e.g. Message::parse() can use it without copying. The
+    Allocator unmaps the file when nothing refers to it any more.
+
+    If spool-directory isn't set, or if anything goes wrong with the
+    file, SpoolFile keeps everything in RAM.
+
+    Whoever uses a SpoolFile must call close() when it's done, so that
+    the file descriptor is closed.
+*/
+
+
+/*! Constructs an empty SpoolFile. */
+
+SpoolFile::SpoolFile()
+    : Garbage(), d( new SpoolFileData )
+{
+}
+
+
+/*! Returns true if the spool-directory is configured, so that large
+    amounts of data may be spooled to disk, and false if not.
+*/
+
+bool SpoolFile::enabled()
+{
+    return !Configuration::text( Configuration::SpoolDirectory ).isEmpty();
+}
+
+
+/*! Returns the number of bytes a SpoolFile keeps in RAM before it
+    starts writing to disk, as set by spool-threshold.
+*/
+
+uint SpoolFile::threshold()
+{
+    return 1024 * Configuration::scalar( Configuration::SpoolThreshold );
+}
+
+
+/*! Appends \a s to this file. */
+
+void SpoolFile::append( const EString & s )
+{
+    append( s.data(), s.length() );
+}
+
+
+/*! Appends the \a n bytes at \a s to this file. */
+
+void SpoolFile::append( const char * s, uint n )
+{
+    if ( !n )
+        return;
+
+    d->contents.truncate();
+    d->size += n;
+
+    if ( d->fd < 0 && d->size > threshold() && enabled() )
+        open();
+
+    if ( d->fd >= 0 && n >= writeSize )
+        flush();
+    if ( d->fd >= 0 && n >= writeSize ) {
+        write( s, n );
+        return;
+    }
+
+    d->pending.append( s, n );
+    if ( d->fd >= 0 && d->pending.length() >= writeSize )
+        flush();
+}
+
+
+/*! Returns the number of bytes append()ed so far. */
+
+uint SpoolFile::size() const
+{
+    return d->size;
+}
+
+
+/*! Returns true if the data is (being) written to a file, and false
+    if it's kept in RAM.
+*/
+
+bool SpoolFile::onDisk() const
+{
+    return d->fd >= 0;
+}
+
+
+/*! Returns everything that's been append()ed.
+
+    If the data has been written to disk, the result is a read-only
+    string backed by the file, and remains valid after close().
+*/
+
+EString SpoolFile::contents()
+{
+    if ( d->fd >= 0 )
+        flush();
+    if ( d->fd < 0 )
+        return d->pending;
+    if ( d->contents.length() == d->size )
+        return d->contents;
+
+    void * m = ::mmap( 0, d->size, PROT_READ, MAP_PRIVATE, d->fd, 0 );
+    if ( m == MAP_FAILED ) {
+        fallBack( "Cannot map spool file (error " + fn( errno ) + ")" );
+        return d->pending;
+    }
+
+    Allocator::addMapping( m, d->size );
+    d->contents = EString::readOnly( (const char *)m, d->size );
+    return d->contents;
+}
+
+
+/*! Closes the file, if there is one, and discards the data. Strings
+    returned by contents() remain valid.
+*/
+
+void SpoolFile::close()
+{
+    if ( d->fd >= 0 )
+        ::close( d->fd );
+    d->fd = -1;
+    d->size = 0;
+    d->written = 0;
+    d->pending.truncate();
+    d->contents.truncate();
+}
+
+
+/*! Creates an unlinked file in the spool-directory and writes what's
+    been append()ed so far there. Logs an error and leaves things as
+    they are if that isn't possible.
+*/
+
+void SpoolFile::open()
+{
+    EString dir = File::chrooted(
+        Configuration::text( Configuration::SpoolDirectory ) );
+    EString name;
+    int fd = -1;
+    uint tries = 0;
+    while ( fd < 0 && tries < 8 ) {
+        name = dir;
+        name.append( "/spool." );
+        name.appendNumber( getpid() );
+        name.append( "." );
+        name.appendNumber( ++::counter );
+        fd = ::open( name.cstr(), O_RDWR|O_CREAT|O_EXCL|O_LARGEFILE, 0600 );
+        if ( fd < 0 && errno != EEXIST )
+            break;
+        tries++;
+    }
+    if ( fd < 0 ) {
+        log( "Cannot create spool file " + name +
+             " (error " + fn( errno ) + ")", Log::Error );
+        return;
+    }
+    ::unlink( name.cstr() );
+    d->fd = fd;
+    flush();
+}
+
+
+/*! Writes the pending data to disk. */
+
+void SpoolFile::flush()
+{
+    if ( d->pending.isEmpty() )
+        return;
+    EString p = d->pending;
+    d->pending.truncate();
+    write( p.data(), p.length() );
+}
+
+
+/*! Writes the \a n bytes at \a s to disk, or if that fails, falls
+    back to keeping everything in RAM.
+*/
+
+void SpoolFile::write( const char * s, uint n )
+{
+    uint i = 0;
+    while ( i < n ) {
+        int r = ::write( d->fd, s + i, n - i );
+        if ( r < 0 && errno == EINTR )
+            continue;
+        if ( r <= 0 ) {
+            fallBack( "Cannot write to spool file (error " +
+                      fn( errno ) + ")" );
+            d->pending.append( s + i, n - i );
+            return;
+        }
+        i += r;
+        d->written += r;
+    }
+}
+
+
+/*! Logs \a error, reads what's been written to disk back into RAM,
+    and closes the file, so that everything continues in RAM.
+*/
+
+void SpoolFile::fallBack( const EString & error )
+{
+    log( error + ", continuing in RAM", Log::Error );
+
+    EString s;
+    s.reserve( d->size );
+    while ( s.length() < d->written ) {
+        char buffer[8192];
+        uint n = d->written - s.length();
+        if ( n > sizeof( buffer ) )
+            n = sizeof( buffer );
+        int r = ::pread( d->fd, buffer, n, s.length() );
+        if ( r < 0 && errno == EINTR )
+            continue;
+        if ( r <= 0 ) {
+            log( "Cannot read spool file (error " + fn( errno ) +
+                 "), data lost", Log::Error );
+            break;
+        }
+        s.append( buffer, r );
+    }
+    s.append( d->pending );
+    d->pending = s;
+    d->written = 0;
+    ::close( d->fd );
+    d->fd = -1;
+}
@@ -0,0 +1,39 @@
+// Copyright 2009 The Archiveopteryx Developers <info@aox.org>
+
+#ifndef SPOOLFILE_H
+#define SPOOLFILE_H
+
+#include "global.h"
+#include "estring.h"
+
+
+class SpoolFile
+    : public Garbage
+{
+public:
+    SpoolFile();
+
+    void append( const EString & );
+    void append( const char *, uint );
+
+    uint size() const;
+    bool onDisk() const;
+
+    EString contents();
+    void close();
+
+    static bool enabled();
+    static uint threshold();
+
+private:
+    void open();
+    void flush();
+    void write( const char *, uint );
+    void fallBack( const EString & );
+
+private:
+    class SpoolFileData * d;
+};
+
+
+#endif
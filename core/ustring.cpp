@@ -14,9 +14,16 @@
 /*! \class UStringData ustring.h
 
     This private helper class contains the actual string data. It has
-    three fields, all accessible only to UString. The only noteworthy
-    field is max, which is 0 in the case of a shared/read-only string,
-    and nonzero in the case of a string which can be modified.
+    four fields, all accessible only to UString. max is 0 in the case
+    of a shared/read-only string, and nonzero in the case of a string
+    which can be modified.
+
+    width is the number of bytes used per code point: 1 if all code
+    points are below U+0100, 2 if all are in the BMP and 4
+    otherwise. Most strings we see are ASCII or Latin-1, so this
+    saves a good deal of memory compared to always storing 32-bit
+    code points. The width only ever grows; UString widens the
+    string when a wider code point is appended.
 */
 
 
@@ -28,16 +35,20 @@
 /*! Creates a new EString with \a words capacity. */
 
 UStringData::UStringData( int words )
-    : str( 0 ), len( 0 ), max( words )
+    : str( 0 ), len( 0 ), max( words ), width( 1 )
 {
     if ( str )
-        str = (uint*)Allocator::alloc( words*sizeof(uint), 0 );
+        str = Allocator::alloc( words*sizeof(uint), 0 );
 }
 
 
+/*! Allocates a UStringData with room for \a extra bytes of string
+    data after it.
+*/
+
 void * UStringData::operator new( size_t ownSize, uint extra )
 {
-    return Allocator::alloc( ownSize + extra*sizeof(uint), 1 );
+    return Allocator::alloc( ownSize + extra, 1 );
 }
 
 
@@ -182,8 +193,18 @@ void UString::append( const UString & other )
         return;
     }
     reserve( length() + other.length() );
-    memmove( d->str+d->len, other.d->str, sizeof(uint)*other.d->len );
-    d->len += other.d->len;
+    if ( other.d->width > d->width )
+        reserve2( d->max, other.d->width );
+    if ( other.d->width == d->width ) {
+        memmove( d->len * d->width + (char*)d->str, other.d->str,
+                 other.d->len * d->width );
+        d->len += other.d->len;
+    }
+    else {
+        uint i = 0;
+        while ( i < other.d->len )
+            d->set( d->len++, other.d->at( i++ ) );
+    }
 }
 
 
@@ -192,7 +213,8 @@ void UString::append( const UString & other )
 void UString::append( const uint cp )
 {
     reserve( length() + 1 );
-    d->str[d->len] = cp;
+    widen( cp );
+    d->set( d->len, cp );
     d->len++;
 }
 
@@ -206,8 +228,34 @@ void UString::append( const char * s )
     if ( !s || !*s )
         return;
     reserve( length() + strlen( s ) );
-    while ( s && *s )
-        d->str[d->len++] = (uint)*s++; // I feel naughty today
+    while ( s && *s ) {
+        uint cp = (uint)*s++; // I feel naughty today
+        widen( cp );
+        d->set( d->len++, cp );
+    }
+}
+
+
+/*! \overload
+    This version of append() appends \a num raw bytes from memory
+    \a base, treating each as an ISO-8859-1 character. If \a base is
+    null, this function does nothing.
+*/
+
+void UString::append( const char * base, uint num )
+{
+    if ( !base || !num )
+        return;
+    reserve( length() + num );
+    if ( d->width == 1 ) {
+        memmove( d->len + (char*)d->str, base, num );
+        d->len += num;
+    }
+    else {
+        uint i = 0;
+        while ( i < num )
+            d->set( d->len++, (unsigned char)base[i++] );
+    }
 }
 
 
@@ -221,37 +269,50 @@ void UString::reserve( uint num )
     if ( !num )
         num = 1;
     if ( !d || d->max < num )
-        reserve2( num );
+        reserve2( num, 1 );
 }
 
 
-/*! Equivalent to reserve(). reserve( \a num ) calls this function to
-    do the heavy lifting. This function is not inline, while reserve()
-    is, and calls to this function should be interesting wrt. memory
-    allocation statistics.
+/*! Equivalent to reserve(), except that the new storage uses at
+    least \a width bytes per code point. reserve( \a num ) and
+    widen() call this function to do the heavy lifting. This function
+    is not inline, while reserve() is, and calls to this function
+    should be interesting wrt. memory allocation statistics.
 
-    Noone except reserve() should call reserve2().
+    Noone except reserve() and widen() should call reserve2().
 */
 
-void UString::reserve2( uint num )
+void UString::reserve2( uint num, uint width )
 {
+    if ( d && d->width > width )
+        width = d->width;
     const uint std = sizeof( UStringData );
-    const uint si = sizeof( uint );
-    num = ( Allocator::rounded( num * si + std ) - std ) / si;
+    num = ( Allocator::rounded( num * width + std ) - std ) / width;
 
     UStringData * freeable = 0;
     if ( d && d->max )
         freeable = d;
 
-    UStringData * nd = new( num ) UStringData( 0 );
+    UStringData * nd = new( num * width ) UStringData( 0 );
     nd->max = num;
-    nd->str = (uint*)(std + (char*)nd);
+    nd->width = width;
+    nd->str = std + (char*)nd;
     if ( d )
         nd->len = d->len;
     if ( nd->len > num )
         nd->len = num;
-    if ( d && d->len )
-        memmove( nd->str, d->str, nd->len*si );
+    if ( d && d->len ) {
+        if ( d->width == width ) {
+            memmove( nd->str, d->str, nd->len * width );
+        }
+        else {
+            uint i = 0;
+            while ( i < nd->len ) {
+                nd->set( i, d->at( i ) );
+                i++;
+            }
+        }
+    }
     d = nd;
 
     if ( freeable )
@@ -284,9 +345,8 @@ bool UString::isAscii() const
         return true;
     uint i = 0;
     while ( i < d->len ) {
-        if ( d->str[i] >= 128 ||
-             ( d->str[i] < 32 &&
-               d->str[i] != 9 && d->str[i] != 10 && d->str[i] != 13 ) )
+        uint c = d->at( i );
+        if ( c >= 128 || ( c < 32 && c != 9 && c != 10 && c != 13 ) )
             return false;
         i++;
     }
@@ -310,8 +370,9 @@ EString UString::ascii() const
     r.reserve( length() );
     uint i = 0;
     while ( i < length() ) {
-        if ( d->str[i] >= ' ' && d->str[i] < 127 )
-            r.append( (char)(d->str[i]) );
+        uint c = d->at( i );
+        if ( c >= ' ' && c < 127 )
+            r.append( (char)c );
         else
             r.append( '?' );
         i++;
@@ -342,8 +403,9 @@ UString UString::mid( uint start, uint num ) const
 
     d->max = 0;
     result.d = new UStringData;
-    result.d->str = d->str + start;
+    result.d->str = start * d->width + (char*)d->str;
     result.d->len = num;
+    result.d->width = d->width;
     return result;
 }
 
@@ -395,7 +457,7 @@ UString UString::simplified() const
     uint i = 0;
     uint first = 0;
     while ( i < length() && first == i ) {
-        if ( isSpace( d->str[i] ) )
+        if ( isSpace( d->at( i ) ) )
             first++;
         i++;
     }
@@ -407,7 +469,7 @@ UString UString::simplified() const
     uint spaces = 0;
     bool identity = true;
     while ( identity && i < length() ) {
-        if ( isSpace( d->str[i] ) ) {
+        if ( isSpace( d->at( i ) ) ) {
             spaces++;
         }
         else {
@@ -428,7 +490,7 @@ UString UString::simplified() const
     bool ogham = false;
     bool zwnbsp = true;
     while ( i < length() ) {
-        int c = d->str[i];
+        int c = d->at( i );
         if ( isSpace( c ) ) {
             if ( c == 0x1680 )
                 ogham = true;
@@ -466,7 +528,7 @@ UString UString::trimmed() const
     uint first = length();
     uint last = 0;
     while ( i < length() ) {
-        if ( !isSpace( d->str[i] ) ) {
+        if ( !isSpace( d->at( i ) ) ) {
             if ( i < first )
                 first = i;
             if ( i > last )
@@ -513,7 +575,7 @@ int UString::compare( const UString & other ) const
         return 0;
     uint i = 0;
     while ( i < length() && i < other.length() &&
-            d->str[i] == other.d->str[i] )
+            d->at( i ) == other.d->at( i ) )
         i++;
     if ( i >= length() && i >= other.length() )
         return 0;
@@ -521,7 +583,7 @@ int UString::compare( const UString & other ) const
         return -1;
     if ( i >= other.length() )
         return 1;
-    if ( d->str[i] < other.d->str[i] )
+    if ( d->at( i ) < other.d->at( i ) )
         return -1;
     return 1;
 }
@@ -573,7 +635,7 @@ bool UString::startsWith( const char * prefix ) const
     if ( !length() )
         return false;
     uint i = 0;
-    while ( i < d->len && prefix[i] && prefix[i] == d->str[i] )
+    while ( i < d->len && prefix[i] && prefix[i] == d->at( i ) )
         i++;
     if ( i > d->len )
         return false;
@@ -606,7 +668,7 @@ bool UString::endsWith( const char * suffix ) const
     if ( l > length() )
         return false;
     uint i = 0;
-    while ( i < l && suffix[i] == d->str[d->len - l + i] )
+    while ( i < l && suffix[i] == d->at( d->len - l + i ) )
         i++;
     if ( i < l )
         return false;
@@ -620,7 +682,7 @@ bool UString::endsWith( const char * suffix ) const
 
 int UString::find( char c, int i ) const
 {
-    while ( i < (int)length() && d->str[i] != c )
+    while ( i < (int)length() && d->at( i ) != c )
         i++;
     if ( i < (int)length() )
         return i;
@@ -636,7 +698,7 @@ int UString::find( const UString & s, int i ) const
 {
     uint j = 0;
     while ( j < s.length() && i+j < length() ) {
-        if ( d->str[i+j] == s.d->str[j] ) {
+        if ( d->at( i+j ) == s.d->at( j ) ) {
             j++;
         }
         else {
@@ -681,7 +743,7 @@ bool UString::contains( const char * s ) const
         uint l = strlen( s );
         uint j = 0;
         while ( j < l && i + j < length() &&
-                d->str[i+j] == s[j] )
+                d->at( i+j ) == s[j] )
             j++;
         if ( j == l )
             return true;
@@ -703,12 +765,13 @@ UString UString::titlecased() const
     UString r = *this;
     uint i = 0;
     while ( i < length() ) {
-        uint cp = d->str[i];
+        uint cp = d->at( i );
         if ( cp < numTitlecaseCodepoints &&
              titlecaseCodepoints[cp] &&
              cp != titlecaseCodepoints[cp] ) {
             r.detach();
-            r.d->str[i] = titlecaseCodepoints[cp];
+            r.widen( titlecaseCodepoints[cp] );
+            r.d->set( i, titlecaseCodepoints[cp] );
         }
         i++;
     }
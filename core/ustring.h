@@ -12,20 +12,46 @@ class UStringData
     : public Garbage
 {
 private:
-    UStringData(): str( 0 ), len( 0 ), max( 0 ) {
+    UStringData(): str( 0 ), len( 0 ), max( 0 ), width( 1 ) {
         setFirstNonPointer( &len );
     }
     UStringData( int );
 
+    static uint widthOf( uint cp ) {
+        if ( cp < 0x100 )
+            return 1;
+        if ( cp < 0x10000 )
+            return 2;
+        return 4;
+    }
+
+    uint at( uint i ) const {
+        if ( width == 1 )
+            return ((const unsigned char *)str)[i];
+        if ( width == 2 )
+            return ((const ushort *)str)[i];
+        return ((const uint *)str)[i];
+    }
+
+    void set( uint i, uint cp ) {
+        if ( width == 1 )
+            ((unsigned char *)str)[i] = cp;
+        else if ( width == 2 )
+            ((ushort *)str)[i] = cp;
+        else
+            ((uint *)str)[i] = cp;
+    }
+
     friend class UString;
     friend bool operator==( const class UString &, const class UString & );
     friend bool operator==( const UString &, const char * );
     void * operator new( size_t, uint );
     void * operator new( size_t s ) { return Garbage::operator new( s); }
 
-    uint * str;
+    void * str;
     uint len;
     uint max;
+    uint width;
 };
 
 
@@ -46,7 +72,7 @@ public:
     uint operator[]( uint i ) const {
         if ( !d || i >= d->len )
             return 0;
-        return d->str[i];
+        return d->at( i );
     }
 
     bool isEmpty() const { return !d || d->len == 0; }
@@ -55,6 +81,7 @@ public:
     void append( const UString & );
     void append( const uint );
     void append( const char * );
+    void append( const char *, uint );
 
     void reserve( uint );
     void truncate( uint = 0 );
@@ -77,7 +104,9 @@ public:
     UString simplified() const;
     UString trimmed() const;
 
-    inline const uint * data() const { return d ? (const uint*)d->str : 0; }
+    inline const unsigned char * narrowData() const {
+        return d && d->width == 1 ? (const unsigned char *)d->str : 0;
+    }
 
     UString titlecased() const;
 
@@ -104,7 +133,12 @@ public:
     static bool isSpace( uint );
 
 private:
-    void reserve2( uint );
+    void reserve2( uint, uint );
+    inline void widen( uint cp ) {
+        uint w = UStringData::widthOf( cp );
+        if ( w > d->width )
+            reserve2( d->max, w );
+    }
 
 
 private:
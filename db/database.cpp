@@ -3,6 +3,7 @@
 #include "database.h"
 
 #include "list.h"
+#include "dict.h"
 #include "estring.h"
 #include "allocator.h"
 #include "configuration.h"
@@ -23,10 +24,16 @@
 
 static uint backendNumber;
 List< Query > *Database::queries;
-static GraphableNumber * queryQueueLength = 0;
+static GraphableNumber * queryQueueLength[3];
 static GraphableNumber * busyDbConnections = 0;
 static GraphableNumber * totalDbConnections = 0;
+static GraphableCounter * cancelledQueries = 0;
+static GraphableHistogram * cancelledQueryTimes = 0;
 static List< Database > *handles;
+static List< Database > *starting;
+static List< Database > *replicas;
+static List< Query > *replicaQueries;
+static time_t lastReplicaCreated;
 static time_t lastExecuted;
 static time_t lastCreated;
 static Database::User loginAs;
@@ -34,8 +41,24 @@ static EString * username;
 static EString * password;
 static List<EventHandler> * whenIdle;
 
+// The scheduling state used by firstSubmittedQuery(): the virtual time
+// of each Query::Priority class, how much each class advances per
+// query (i.e. the inverse of its weight), how many queries each
+// submitter has had in each class since the class last was empty, and
+// how many submitters that is.
+static uint pass[3];
+static const uint stride[3] = { 1, 2, 8 };
+static Dict<uint> * served[3];
+static uint submitters[3];
 
-static void newHandle()
+// The pool sizing state used by runQueue(): a running average of how
+// long queries take once sent to the server, and how long we want
+// queries to wait for a handle (both in microseconds).
+static uint serviceTime = 10000;
+static const uint targetWait = 50000;
+
+
+static void newHandle( bool replica = false )
 {
     Scope x;
     if ( handles && !handles->isEmpty() ) {
@@ -45,7 +68,12 @@ static void newHandle()
         if ( l )
             x.setLog( l );
     }
-    (void)new Postgres;
+    Database * d = new Postgres( replica );
+    if ( !::starting ) {
+        ::starting = new List< Database >;
+        Allocator::addEternal( ::starting, "starting database handles" );
+    }
+    ::starting->append( d );
 }
 
 
@@ -59,10 +87,18 @@ static void newHandle()
     interface classes we implement). It's responsible for validating the
     database configuration, maintaining a pool of database handles, and
     accepting queries into a common queue via submit().
+
+    If db-replica-address is set, it also maintains a small pool of
+    handles connected to a read-only replica (such as a PostgreSQL hot
+    standby), which process the Query::readOnly() queries.
 */
 
-Database::Database()
-    : Connection()
+/*! Constructs a Database handle. If \a replica is true, the handle
+    connects to the replica and takes only read-only queries.
+*/
+
+Database::Database( bool replica )
+    : Connection(), rep( replica )
 {
     number = ++::backendNumber;
     setType( Connection::DatabaseClient );
@@ -94,6 +130,13 @@ void Database::setup( uint desired, const EString & user,
         Allocator::addEternal( handles, "list of database handles" );
     }
 
+    if ( !replicas ) {
+        replicas = new List< Database >;
+        Allocator::addEternal( replicas, "list of replica handles" );
+        replicaQueries = new List< Query >;
+        Allocator::addEternal( replicaQueries, "list of replica queries" );
+    }
+
     if ( ::username )
         Allocator::removeEternal( ::username );
     ::username = new EString( user );
@@ -130,6 +173,9 @@ void Database::addInitialHandles( uint desired )
         if ( Configuration::toggle( Configuration::Security ) &&
              srv.protocol() == Endpoint::Unix )
             desired = max;
+        uint min = Configuration::scalar( Configuration::DbMinHandles );
+        if ( desired < min )
+            desired = min;
         if ( desired > max )
             desired = max;
     }
@@ -138,6 +184,15 @@ void Database::addInitialHandles( uint desired )
         newHandle();
         desired--;
     }
+
+    if ( !Configuration::text( Configuration::DbReplicaAddress ).isEmpty() ) {
+        uint n = Configuration::scalar( Configuration::DbReplicaHandles );
+        while ( n ) {
+            newHandle( true );
+            n--;
+        }
+        lastReplicaCreated = time( 0 );
+    }
 }
 
 
@@ -173,12 +228,15 @@ void Database::setup( uint desired, Database::User login )
 
 /*! Adds \a q to the queue of submitted queries and sets its state to
     Query::Submitted. The first available handle will process it.
+
+    If \a q is Query::readOnly() and not part of a Transaction, and we
+    have a connection to a db-replica-address, a replica handle may
+    process it instead.
 */
 
 void Database::submit( Query *q )
 {
-    queries->append( q );
-    q->setState( Query::Submitted );
+    enqueue( q );
     runQueue();
 }
 
@@ -193,14 +251,28 @@ void Database::submit( List< Query > *q )
 {
     List< Query >::Iterator it( q );
     while ( it ) {
-        it->setState( Query::Submitted );
-        queries->append( it );
+        enqueue( it );
         ++it;
     }
     runQueue();
 }
 
 
+/*! This private helper adds \a q to the right queue and sets its
+    state to Query::Submitted.
+*/
+
+void Database::enqueue( Query * q )
+{
+    if ( q->readOnly() && !q->transaction() &&
+         replicas && !replicas->isEmpty() )
+        replicaQueries->append( q );
+    else
+        queries->append( q );
+    q->setState( Query::Submitted );
+}
+
+
 /*! This extremely evil function shuts down all Database handles. It's
     used only by lib/installer to reconnect to the database.  Once
     it's done, setup() may be called again with an appropriately
@@ -217,6 +289,14 @@ void Database::disconnect()
         it->react( Shutdown );
         ++it;
     }
+    if ( !replicas )
+        return;
+    List< Database >::Iterator r( replicas );
+    while ( r ) {
+        Database * d = r;
+        ++r;
+        d->react( Shutdown );
+    }
 }
 
 
@@ -230,14 +310,44 @@ void Database::runQueue()
     int connecting = 0;
     int busy = 0;
 
-    if ( !queryQueueLength )
-        queryQueueLength = new GraphableNumber( "query-queue-length" );
+    if ( !queryQueueLength[0] ) {
+        uint n = 0;
+        while ( n < 3 ) {
+            Query::Priority p = (Query::Priority)n;
+            queryQueueLength[n] =
+                new GraphableNumber( EString( "query-queue-length-" ) +
+                                     Query::priorityName( p ) );
+            n++;
+        }
+    }
     if ( !busyDbConnections )
         busyDbConnections = new GraphableNumber( "active-db-connections" );
 
-    // First, we give each idle handle a Query to process
+    // First, we give each idle replica handle a read-only Query, and
+    // each idle handle a Query to process
 
-    Query * first = queries->firstElement();
+    if ( replicaQueries && !replicaQueries->isEmpty() ) {
+        List< Database >::Iterator r( replicas );
+        while ( r && !replicaQueries->isEmpty() ) {
+            if ( r->state() == Idle && r->usable() )
+                r->processQueue();
+            ++r;
+        }
+    }
+
+    if ( replicas && replicas->isEmpty() &&
+         !Configuration::text( Configuration::DbReplicaAddress ).isEmpty() &&
+         !EventLoop::global()->inShutdown() &&
+         time( 0 ) - lastReplicaCreated >=
+         (int)Configuration::scalar( Configuration::DbHandleInterval ) &&
+         ( replicaServer().protocol() != Endpoint::Unix ||
+           replicaServer().address().startsWith( File::root() ) ) ) {
+        // we lost the replica handles, so we try again now and then
+        lastReplicaCreated = time( 0 );
+        newHandle( true );
+    }
+
+    uint queued = queries->count();
 
     List< Database >::Iterator it( handles );
     while ( it ) {
@@ -253,7 +363,9 @@ void Database::runQueue()
         if ( st == Idle && it->usable() ) {
             it->processQueue();
             if ( queries->isEmpty() ) {
-                queryQueueLength->setValue( 0 );
+                queryQueueLength[0]->setValue( 0 );
+                queryQueueLength[1]->setValue( 0 );
+                queryQueueLength[2]->setValue( 0 );
                 busyDbConnections->setValue( busy );
                 return;
             }
@@ -265,12 +377,20 @@ void Database::runQueue()
         ++it;
     }
 
-    queryQueueLength->setValue( queries->count() );
+    uint length[3] = { 0, 0, 0 };
+    List< Query >::Iterator q( queries );
+    while ( q ) {
+        length[q->priority()]++;
+        ++q;
+    }
+    queryQueueLength[0]->setValue( length[0] );
+    queryQueueLength[1]->setValue( length[1] );
+    queryQueueLength[2]->setValue( length[2] );
     busyDbConnections->setValue( busy );
 
-    // If there's nothing to do, or we did get something done, then we
-    // don't even consider opening a new database connection.
-    if ( queries->isEmpty() || first != queries->firstElement() )
+    // If there's nothing to do, then we don't even consider opening a
+    // new database connection.
+    if ( queries->isEmpty() )
         return;
 
     // Even if we want to, we cannot create unix-domain handles when
@@ -284,15 +404,71 @@ void Database::runQueue()
     if ( EventLoop::global()->inShutdown() )
         return;
 
-    // We create at most one new handle per interval.
-    int interval = Configuration::scalar( Configuration::DbHandleInterval );
-    if ( time( 0 ) - lastCreated < interval )
+    // Handles which failed to connect don't count as starting.
+    List< Database >::Iterator s( ::starting );
+    while ( s ) {
+        if ( s->valid() )
+            ++s;
+        else
+            ::starting->take( s );
+    }
+    uint pending = 0;
+    List< Database >::Iterator p( ::starting );
+    while ( p ) {
+        if ( !p->isReplica() )
+            pending++;
+        ++p;
+    }
+
+    // We estimate how many handles it would take to start all the
+    // waiting queries within targetWait, given the time queries have
+    // taken recently. Handles which are being started count too.
+    int64 w = ( (int64)queries->count() * serviceTime + targetWait - 1 ) /
+              targetWait;
+    uint wanted = queries->count();
+    if ( w < wanted )
+        wanted = (uint)w;
+    if ( wanted <= pending )
         return;
+    uint n = wanted - pending;
+
+    // If the queue isn't actually slow, we create at most one handle
+    // per interval, and only if we didn't get anything done. If it
+    // is, we create as many as we need at once.
+    if ( queries->firstElement()->waitTime() < targetWait ) {
+        int interval =
+            Configuration::scalar( Configuration::DbHandleInterval );
+        if ( queries->count() < queued ||
+             time( 0 ) - lastCreated < interval )
+            return;
+        n = 1;
+    }
 
-    // If we don't have too many, we can create another handle!
+    // But we never have more than db-max-handles.
     uint max = Configuration::scalar( Configuration::DbMaxHandles );
-    if ( handles->count() < max )
+    uint open = handles->count() + pending;
+    while ( n && open < max ) {
         newHandle();
+        open++;
+        n--;
+    }
+}
+
+
+/*! Records that \a q has been executed, so that runQueue() can
+    estimate how many handles it needs.
+
+    Queries which never waited in the queue (such as those a handle
+    sends by itself when it starts up) have no submission time, so
+    they're ignored.
+*/
+
+void Database::recordQueryTime( Query * q )
+{
+    if ( !q->totalTime() )
+        return;
+    uint t = q->totalTime() - q->waitTime();
+    serviceTime = serviceTime - serviceTime / 8 + t / 8;
 }
 
 
@@ -324,6 +500,12 @@ Database::State Database::state() const
 
 void Database::addHandle( Database * d )
 {
+    if ( ::starting )
+        ::starting->remove( d );
+    if ( d->isReplica() ) {
+        replicas->append( d );
+        return;
+    }
     handles->append( d );
     if ( !totalDbConnections )
         totalDbConnections = new GraphableNumber( "total-db-connections" );
@@ -335,6 +517,25 @@ void Database::addHandle( Database * d )
 
 void Database::removeHandle( Database * d )
 {
+    if ( ::starting )
+        ::starting->remove( d );
+    if ( d->isReplica() ) {
+        if ( !replicas )
+            return;
+        replicas->remove( d );
+        if ( !replicas->isEmpty() )
+            return;
+        // with no replica left, the primary has to do the work
+        List< Query >::Iterator q( replicaQueries );
+        while ( q ) {
+            queries->append( q );
+            ++q;
+        }
+        replicaQueries->clear();
+        if ( handles && !queries->isEmpty() )
+            runQueue();
+        return;
+    }
     if ( !handles )
         return;
 
@@ -376,6 +577,27 @@ Endpoint Database::server()
 }
 
 
+/*! Returns the endpoint of the read-only replica database server
+    (db-replica-address and db-replica-port).
+*/
+
+Endpoint Database::replicaServer()
+{
+    return Endpoint( Configuration::DbReplicaAddress,
+                     Configuration::DbReplicaPort );
+}
+
+
+/*! Returns true if this handle is connected to the replica rather
+    than to the primary database server, and false otherwise.
+*/
+
+bool Database::isReplica() const
+{
+    return rep;
+}
+
+
 /*! Returns the address of the database server (db-address). */
 
 EString Database::address()
@@ -517,6 +739,16 @@ bool Database::idle()
     if ( queries && !queries->isEmpty() )
         return false;
 
+    List< Database >::Iterator r( replicas );
+    while ( r ) {
+        if ( !r->usable() )
+            return false;
+        ++r;
+    }
+
+    if ( replicaQueries && !replicaQueries->isEmpty() )
+        return false;
+
     return true;
 }
 
@@ -528,7 +760,8 @@ bool Database::idle()
 
 void Database::reactToIdleness()
 {
-    if ( !queries->isEmpty() )
+    if ( !queries->isEmpty() ||
+         ( replicaQueries && !replicaQueries->isEmpty() ) )
         return;
 
     if ( !::whenIdle )
@@ -634,7 +867,8 @@ void Database::checkAccess( EventHandler * owner )
 
 
 /*! Returns the number of handles we think we need at this
-    time. Mostly computed based on recent workload.
+    time. Mostly computed based on recent workload, but never fewer
+    than db-min-handles.
 */
 
 uint Database::handlesNeeded()
@@ -654,9 +888,12 @@ uint Database::handlesNeeded()
     if ( needed < recently - 1 )
         needed = recently - 1;
 
-    // we do need a handle
-    if ( needed < 1 )
-        needed = 1;
+    // we do need a few handles
+    uint min = Configuration::scalar( Configuration::DbMinHandles );
+    if ( min < 1 )
+        min = 1;
+    if ( needed < min )
+        needed = min;
 
     // now that we know...
     return needed;
@@ -695,9 +932,105 @@ void Database::cancelQuery( Query * q )
         it->cancel( q );
         ++it;
     }
+    List<Database>::Iterator r( replicas );
+    while ( r ) {
+        r->cancel( q );
+        ++r;
+    }
+}
+
+
+/*! Returns true if \a q is being done on behalf of \a l (or one of its
+    children), isn't part of a Transaction, and isn't done yet.
+*/
+
+static bool abandoned( Query * q, Log * l )
+{
+    if ( q->transaction() || q->done() )
+        return false;
+    Log * ql = q->log();
+    return ql && ql->isChildOf( l );
+}
+
+
+/*! Cancels all queries which are done on behalf of \a l (or any of
+    its children) and aren't part of a Transaction, whether they're
+    still waiting for a handle or already being executed. This is
+    meant to be used when a client disconnects, so that nothing keeps
+    a handle busy for the client's sake.
+
+    Each cancelled query is counted, and for the ones which were being
+    executed, the time they had taken so far is recorded.
+*/
+
+void Database::cancelQueries( Log * l )
+{
+    if ( !l || !queries )
+        return;
+
+    if ( !cancelledQueries ) {
+        cancelledQueries = new GraphableCounter( "queries-cancelled" );
+        cancelledQueryTimes =
+            new GraphableHistogram( "cancelled-query-time" );
+    }
+
+    List< Query > waiting;
+    List< Query >::Iterator q( queries );
+    while ( q ) {
+        if ( abandoned( q, l ) )
+            waiting.append( queries->take( q ) );
+        else
+            ++q;
+    }
+    List< Query >::Iterator r( replicaQueries );
+    while ( r ) {
+        if ( abandoned( r, l ) )
+            waiting.append( replicaQueries->take( r ) );
+        else
+            ++r;
+    }
+
+    List< Query >::Iterator w( waiting );
+    while ( w ) {
+        cancelledQueries->tick();
+        w->cancel();
+        ++w;
+    }
+
+    List< Database > all;
+    all.append( handles );
+    all.append( replicas );
+    List< Database >::Iterator h( all );
+    while ( h ) {
+        List< Query > executing;
+        List< Query >::Iterator e( h->activeQueries() );
+        while ( e ) {
+            if ( abandoned( e, l ) )
+                executing.append( e );
+            ++e;
+        }
+        List< Query >::Iterator c( executing );
+        while ( c ) {
+            cancelledQueries->tick();
+            c->cancel();
+            cancelledQueryTimes->addNumber( c->totalTime() -
+                                            c->waitTime() );
+            h->cancel( c );
+            ++c;
+        }
+        ++h;
+    }
 }
 
 
+/*! \fn List< Query > * Database::activeQueries()
+
+    Returns a pointer to the list of queries which this handle has sent
+    to the server and which aren't finished yet. The list may be empty,
+    but the pointer is never null.
+*/
+
+
 /*! This static function returns the schema revision current at the time
     this server was compiled.
 */
@@ -708,25 +1041,167 @@ uint Database::currentRevision()
 }
 
 
+/* Discards the firstSubmittedQuery() counts for those submitters
+   that have no queries waiting in class \a c of \a queries, so that
+   the counts don't grow without bound on a busy server.
+*/
+
+static void forgetIdleSubmitters( uint c, List<Query> * queries )
+{
+    Dict<uint> active;
+    uint n = 0;
+    List<Query>::Iterator i( queries );
+    while ( i ) {
+        EString k = i->submitter();
+        if ( (uint)i->priority() == c && !active.contains( k ) ) {
+            uint * s = served[c]->find( k );
+            if ( s ) {
+                active.insert( k, s );
+                n++;
+            }
+        }
+        ++i;
+    }
+
+    served[c]->clear();
+    List<Query>::Iterator j( queries );
+    while ( j ) {
+        if ( (uint)j->priority() == c ) {
+            uint * s = active.remove( j->submitter() );
+            if ( s )
+                served[c]->insert( j->submitter(), s );
+        }
+        ++j;
+    }
+    submitters[c] = n;
+}
+
+
 /*! Removes a submitted transaction from the global list and returns a
     list contains just that transaction.
 
     If \a transactionOK is true, the list is permitted to start a
     Transaction. If not, only standalone queries are considered.
 
+    The query is chosen by weighted fair queueing: Each
+    Query::Priority class gets a share of the handles (interactive
+    queries eight times as much as background ones, delivery four
+    times), and within a class, each Query::submitter() gets an equal
+    share. The last db-interactive-handles idle handles are kept for
+    interactive queries.
+
     Returns an empty list if no suitable queries can be found.
 */
 
 List< Query > * Database::firstSubmittedQuery( bool transactionOK )
 {
-    List<Query>::Iterator i( queries );
-    if ( !transactionOK )
-        while ( i && i->transaction() )
-            ++i;
     List<Query> * r = new List<Query>();
-    if ( i ) {
-        r->append( i );
-        queries->take( i );
+
+    // queries which were cancelled while waiting don't need a handle
+    List<Query>::Iterator x( isReplica() ? replicaQueries : queries );
+    while ( x ) {
+        if ( x->done() )
+            ( isReplica() ? replicaQueries : queries )->take( x );
+        else
+            ++x;
+    }
+
+    if ( isReplica() ) {
+        if ( replicaQueries && !replicaQueries->isEmpty() )
+            r->append( replicaQueries->shift() );
+        return r;
+    }
+
+    // the last db-interactive-handles idle handles work only on
+    // interactive queries, but the last handle can't be reserved.
+    uint reserved =
+        Configuration::scalar( Configuration::DbInteractiveHandles );
+    if ( reserved && reserved >= numHandles() )
+        reserved = numHandles() ? numHandles() - 1 : 0;
+    bool any = idleHandles() > reserved;
+
+    // look at each waiting query once, noting which classes have
+    // work, and the best candidate in each class: the oldest query
+    // from the submitter who's been served least, so one busy client
+    // can't starve others.
+    bool queued[3] = { false, false, false };
+    bool eligible[3] = { false, false, false };
+    uint waiting[3] = { 0, 0, 0 };
+    uint least[3] = { 0, 0, 0 };
+    List<Query>::Iterator best[3];
+    List<Query>::Iterator i( queries );
+    while ( i ) {
+        uint c = i->priority();
+        queued[c] = true;
+        waiting[c]++;
+        if ( ( transactionOK || !i->transaction() ) &&
+             ( any || c == Query::Interactive ) ) {
+            eligible[c] = true;
+            uint * s = 0;
+            if ( served[c] )
+                s = served[c]->find( i->submitter() );
+            uint v = s ? *s : 0;
+            if ( !best[c] || v < least[c] ) {
+                best[c] = i;
+                least[c] = v;
+            }
+        }
+        ++i;
     }
+
+    // pick the eligible class whose virtual time is lowest, so the
+    // classes share the handles in proportion to their weights...
+    int c = -1;
+    uint n = 0;
+    while ( n < 3 ) {
+        if ( eligible[n] && ( c < 0 || pass[n] < pass[c] ) )
+            c = n;
+        n++;
+    }
+    if ( c < 0 )
+        return r;
+
+    // ... without letting a class bank time while it has no work
+    n = 0;
+    while ( n < 3 ) {
+        if ( !queued[n] && pass[n] < pass[c] )
+            pass[n] = pass[c];
+        n++;
+    }
+    pass[c] += stride[c];
+
+    Query * q = queries->take( best[c] );
+    r->append( q );
+
+    if ( waiting[c] > 1 ) {
+        if ( !served[c] ) {
+            served[c] = new Dict<uint>;
+            Allocator::addEternal( served[c],
+                                   "per-submitter query counts" );
+        }
+        uint * s = served[c]->find( q->submitter() );
+        if ( !s ) {
+            s = new uint;
+            *s = 0;
+            served[c]->insert( q->submitter(), s );
+            submitters[c]++;
+        }
+        ++*s;
+        // submitters come and go while the class is busy, so we
+        // forget those who have nothing waiting now and then
+        if ( submitters[c] > 2 * waiting[c] + 16 )
+            forgetIdleSubmitters( c, queries );
+    }
+    else if ( served[c] ) {
+        served[c]->clear();
+        submitters[c] = 0;
+    }
+
+    if ( queries->isEmpty() ) {
+        pass[0] = 0;
+        pass[1] = 0;
+        pass[2] = 0;
+    }
+
     return r;
 }
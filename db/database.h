@@ -14,7 +14,7 @@ class Database
     : public Connection
 {
 public:
-    Database();
+    Database( bool = false );
 
     enum User {
         Superuser, DbOwner, DbUser
@@ -40,6 +40,7 @@ public:
     static EString type();
 
     uint connectionNumber() const;
+    bool isReplica() const;
 
     static uint currentRevision();
 
@@ -52,6 +53,9 @@ public:
     virtual void cancel( Query * ) = 0;
 
     static void cancelQuery( Query * );
+    static void cancelQueries( class Log * );
+
+    virtual List< Query > * activeQueries() = 0;
 
 protected:
     static List< Query > *queries;
@@ -62,12 +66,14 @@ protected:
     State state() const;
 
     static void runQueue();
+    static void enqueue( Query * );
 
     static void addHandle( Database * );
     static void removeHandle( Database * );
     static void addInitialHandles( uint = 3);
 
     static Endpoint server();
+    static Endpoint replicaServer();
     static EString address();
     static uint port();
 
@@ -77,11 +83,13 @@ protected:
     static User loginAs();
 
     static void recordExecution();
+    static void recordQueryTime( Query * );
     static void reactToIdleness();
 
 private:
     State st;
     uint number;
+    bool rep;
 };
 
 
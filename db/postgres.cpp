@@ -3,6 +3,7 @@
 #include "postgres.h"
 
 #include "dict.h"
+#include "map.h"
 #include "list.h"
 #include "estring.h"
 #include "buffer.h"
@@ -32,6 +33,45 @@ static uint serverVersion;
 static Postgres * listener = 0;
 
 
+// The named statements we've used, and how often, so that new handles
+// can prepare the most popular ones before they take any work.
+class HotStatement
+    : public Garbage
+{
+public:
+    HotStatement( const EString & n, const EString & t )
+        : name( n ), text( t ), uses( 0 ) {}
+
+    EString name;
+    EString text;
+    uint uses;
+};
+
+static Dict<HotStatement> * hotStatements;
+static List<HotStatement> * hotList;
+static const uint maxWarmStatements = 16;
+
+
+// The nextmodseq we've last seen for each mailbox on the replica. The
+// replica only ever moves forward, so if it has reached a given
+// modseq once, it still has.
+static Map<int64> * replicaModSeqs;
+static GraphableCounter * staleReads;
+
+static GraphableCounter * timedOutQueries;
+
+
+static bool replicaIsFresh( Query * q )
+{
+    if ( !q->requiredMailbox() )
+        return true;
+    if ( !replicaModSeqs )
+        return false;
+    int64 * m = replicaModSeqs->find( q->requiredMailbox() );
+    return m && *m >= q->requiredModSeq();
+}
+
+
 class PgData
     : public Garbage
 {
@@ -43,7 +83,7 @@ public:
           sendingCopy( false ), error( false ),
           keydata( 0 ),
           description( 0 ), transaction( 0 ),
-          needNotify( 0 ), backendPid( 0 )
+          needNotify( 0 ), backendPid( 0 ), statementTimeout( 0 )
         {}
 
     bool active;
@@ -68,6 +108,7 @@ public:
     EString user;
 
     uint backendPid;
+    uint statementTimeout;
 
     class LockSpotter
         : public EventHandler {
@@ -117,6 +158,68 @@ public:
         }
         Query * q;
     };
+
+    class ReplicaCheck
+        : public EventHandler {
+    public:
+        ReplicaCheck( Query * query ): EventHandler(), r( query ) {
+            setLog( new Log( r->log() ) );
+            q = new Query( "select nextmodseq from mailboxes where id=$1",
+                           this );
+            q->bind( 1, r->requiredMailbox() );
+            q->allowFailure();
+        }
+        void execute() {
+            if ( !q->done() )
+                return;
+            Row * row = q->nextRow();
+            if ( row && !q->failed() ) {
+                if ( !replicaModSeqs ) {
+                    replicaModSeqs = new Map<int64>;
+                    Allocator::addEternal( replicaModSeqs,
+                                           "replica modseqs" );
+                }
+                int64 * m = replicaModSeqs->find( r->requiredMailbox() );
+                if ( !m ) {
+                    m = new int64;
+                    *m = 0;
+                    replicaModSeqs->insert( r->requiredMailbox(), m );
+                }
+                if ( *m < row->getBigint( "nextmodseq" ) )
+                    *m = row->getBigint( "nextmodseq" );
+            }
+            if ( !replicaIsFresh( r ) ) {
+                // the replica lags, so we let the primary do it
+                if ( !staleReads )
+                    staleReads = new GraphableCounter( "replica-stale-reads" );
+                staleReads->tick();
+                r->setReadOnly( false );
+            }
+            Database::submit( r );
+        }
+        Query * r;
+        Query * q;
+    };
+
+    class Warmer
+        : public EventHandler {
+    public:
+        Warmer( Postgres * p, PgData * d, HotStatement * h )
+            : EventHandler(), owner( p ), pd( d ), name( h->name ) {
+            setLog( p->log() );
+            q = new Query( "prepare " + name.quoted() + " as " + h->text,
+                           this );
+            q->allowFailure();
+        }
+        void execute() {
+            if ( q->done() && !q->failed() )
+                pd->prepared.insert( name, owner );
+        }
+        Postgres * owner;
+        PgData * pd;
+        EString name;
+        Query * q;
+    };
 };
 
 
@@ -142,26 +245,37 @@ public:
 /*! Creates a Postgres object, initiates a TCP connection to the server,
     registers with the main loop, and adds this Database to the list of
     available handles.
+
+    If \a replica is true, the connection is to the db-replica-address
+    instead, and the handle processes only read-only queries.
 */
 
-Postgres::Postgres()
-    : Database(), d( new PgData )
+Postgres::Postgres( bool replica )
+    : Database( replica ), d( new PgData )
 {
+    EString a( address() );
+    uint port = Database::port();
+    if ( replica ) {
+        a = replicaServer().address();
+        port = replicaServer().port();
+    }
+
     d->user = Database::user();
     struct passwd * p = getpwnam( d->user.cstr() );
     if ( p && getuid() != p->pw_uid ) {
         // Try to cooperate with ident authentication.
         uid_t e = geteuid();
         setreuid( 0, p->pw_uid );
-        connect( address(), port() );
+        connect( a, port );
         setreuid( 0, e );
     }
     else {
-        connect( address(), port() );
+        connect( a, port );
     }
 
-    log( "Connecting to PostgreSQL server at " +
-         address() + ":" + fn( port() ) + " "
+    log( "Connecting to PostgreSQL " +
+         EString( replica ? "replica" : "server" ) + " at " +
+         a + ":" + fn( port ) + " "
          "(backend " + fn( connectionNumber() ) + ", fd " + fn( fd() ) +
          ", user " + d->user + ")", Log::Debug );
 
@@ -191,7 +305,7 @@ void Postgres::processQueue()
            d->transaction->state() == Transaction::RolledBack ) )
         d->transaction = 0;
 
-    if ( !::listener && !d->transaction )
+    if ( !::listener && !d->transaction && !isReplica() )
         ::listener = this;
     if ( ::listener == this )
         sendListen();
@@ -206,6 +320,9 @@ void Postgres::processQueue()
         else
             l = Database::firstSubmittedQuery( true );
 
+        if ( l->firstElement() )
+            setStatementTimeout( l->firstElement() );
+
         if ( l->firstElement() && l->firstElement()->transaction() ) {
             Transaction * t = l->firstElement()->transaction();
             d->transaction = t;
@@ -216,13 +333,16 @@ void Postgres::processQueue()
     Query * q = l->shift();
     while ( q ) {
         q->setState( Query::Executing );
-        if ( !d->error ) {
-            processQuery( q );
-        }
-        else {
+        if ( d->error ) {
             q->setError( "Database handle no longer usable." );
             q->notify();
         }
+        else if ( isReplica() && !replicaIsFresh( q ) ) {
+            processQuery( (new PgData::ReplicaCheck( q ))->q );
+        }
+        else {
+            processQuery( q );
+        }
         q = l->shift();
     }
 
@@ -231,6 +351,34 @@ void Postgres::processQueue()
 }
 
 
+/*! Makes sure that the backend's statement_timeout is the one
+    configured for the Query::Priority class of \a q (e.g.
+    db-interactive-timeout). This must be called outside transactions,
+    since a SET in a transaction which fails would be undone.
+*/
+
+void Postgres::setStatementTimeout( Query * q )
+{
+    Configuration::Scalar s = Configuration::DbInteractiveTimeout;
+    if ( q->priority() == Query::Delivery )
+        s = Configuration::DbDeliveryTimeout;
+    else if ( q->priority() == Query::Background )
+        s = Configuration::DbBackgroundTimeout;
+    uint t = Configuration::scalar( s );
+    if ( t == d->statementTimeout )
+        return;
+
+    d->statementTimeout = t;
+    Query * set = 0;
+    if ( t )
+        set = new Query( "set statement_timeout=" + fn( t * 1000 ), 0 );
+    else
+        set = new Query( "reset statement_timeout", 0 );
+    set->allowFailure();
+    processQuery( set );
+}
+
+
 /*! Sends whatever messages are required to make the backend process the
     query \a q.
 */
@@ -239,7 +387,7 @@ void Postgres::processQuery( Query * q )
 {
     Scope x( q->log() );
     d->queries.append( q );
-    EString s( "Sent " );
+    bool parsed = false;
     if ( q->name() == "" ||
          !d->prepared.contains( q->name() ) )
     {
@@ -251,7 +399,23 @@ void Postgres::processQuery( Query * q )
             d->preparesPending.append( q->name() );
         }
 
-        s.append( "parse/" );
+        parsed = true;
+    }
+
+    if ( q->name() != "" ) {
+        if ( !hotStatements ) {
+            hotStatements = new Dict<HotStatement>;
+            Allocator::addEternal( hotStatements, "hot statements" );
+            hotList = new List<HotStatement>;
+            Allocator::addEternal( hotList, "hot statement list" );
+        }
+        HotStatement * h = hotStatements->find( q->name() );
+        if ( !h ) {
+            h = new HotStatement( q->name(), queryString( q ) );
+            hotStatements->insert( q->name(), h );
+            hotList->append( h );
+        }
+        h->uses++;
     }
 
     PgBind b( q->name() );
@@ -267,11 +431,16 @@ void Postgres::processQuery( Query * q )
     PgSync e;
     e.enqueue( writeBuffer() );
 
-    s.append( "execute for " );
-    s.append( q->description() );
-    s.append( " on backend " );
-    s.appendNumber( connectionNumber() );
-    ::log( s, Log::Debug );
+    if ( Log::enabled( Log::Debug ) ) {
+        EString s( "Sent " );
+        if ( parsed )
+            s.append( "parse/" );
+        s.append( "execute for " );
+        s.append( q->description() );
+        s.append( " on backend " );
+        s.appendNumber( connectionNumber() );
+        ::log( s, Log::Debug );
+    }
     recordExecution();
 }
 
@@ -354,7 +523,7 @@ void Postgres::react( Event e )
                 log( "Transaction unexpectedly slow; continuing " );
         }
         else if ( d->queries.isEmpty() &&
-                  ::listener != this &&
+                  ::listener != this && !isReplica() &&
                   server().protocol() != Endpoint::Unix &&
                   handlesNeeded() < numHandles() ) {
             log( "Closing idle database backend " + fn( connectionNumber() ) +
@@ -475,6 +644,7 @@ void Postgres::backendStartup( char type )
             processQuery( new Query( "SET SESSION AUTHORIZATION " +
                                      Database::user(), 0 ) );
 
+        prepareHotStatements();
         break;
 
     case 'K':
@@ -491,6 +661,44 @@ void Postgres::backendStartup( char type )
 }
 
 
+/*! Prepares the named statements which have been used most often so
+    far, so that this handle doesn't have to parse them while it's
+    busy. This is called at the end of startup, and since the handle
+    isn't usable() until they're done, it won't take any work before
+    then.
+
+    If a statement can't be prepared this way, it's parsed on first
+    use as usual.
+*/
+
+void Postgres::prepareHotStatements()
+{
+    if ( !hotList || isReplica() )
+        return;
+
+    List<HotStatement> hot;
+    List<HotStatement>::Iterator i( hotList );
+    while ( i ) {
+        List<HotStatement>::Iterator h( hot );
+        while ( h && h->uses >= i->uses )
+            ++h;
+        hot.insert( h, i );
+        if ( hot.count() > maxWarmStatements )
+            hot.take( hot.last() );
+        ++i;
+    }
+
+    List<HotStatement>::Iterator h( hot );
+    while ( h ) {
+        processQuery( (new PgData::Warmer( this, d, h ))->q );
+        ++h;
+    }
+    if ( !hot.isEmpty() )
+        log( "Preparing " + fn( hot.count() ) + " statements on backend " +
+             fn( connectionNumber() ), Log::Debug );
+}
+
+
 /*! This function handles interaction with the server once the startup
     phase is complete. It is called by react() with the \a type of the
     message to process.
@@ -888,6 +1096,13 @@ void Postgres::serverMessage()
         ::log( s, Log::Debug );
     }
     else if ( q && !code.startsWith( "00" ) ) {
+        // 57014 is query_canceled. if we didn't cancel q ourselves,
+        // it must have run into the statement_timeout.
+        if ( code == "57014" && !q->failed() ) {
+            if ( !timedOutQueries )
+                timedOutQueries = new GraphableCounter( "queries-timed-out" );
+            timedOutQueries->tick();
+        }
         s.append( "PostgreSQL server: " );
         s.append( "Query " + q->description() + " failed: " );
         x.setLog( q->log() );
@@ -912,6 +1127,7 @@ void Postgres::serverMessage()
         if ( !msg.detail().isEmpty() )
             s.append( " (" + msg.detail() + ")" );
         q->setError( m );
+        countQueries( q );
         q->notify();
     }
     else {
@@ -1121,25 +1337,120 @@ bool Postgres::usable() const
 
 static GraphableCounter * goodQueries = 0;
 static GraphableCounter * badQueries = 0;
+static GraphableHistogram * waitTimes = 0;
+static GraphableHistogram * firstRowTimes = 0;
+static GraphableHistogram * totalTimes = 0;
+static GraphableHistogram * classWaitTimes[3];
+
+// no more than this many per-shape histograms are created
+static const uint maxShapes = 64;
+static uint shapes = 0;
+
+
+/* Returns a short name describing the shape of the query \a s, such
+   as "select-messages" or "copy-header-fields", which is suitable for
+   use in a GraphableHistogram name.
+*/
+
+static EString shape( const EString & s )
+{
+    EString q = s.mid( 0, 256 ).simplified().lower();
+    EString verb = q.section( " ", 1 );
+    EString table;
+    int i = -1;
+    if ( verb == "select" || verb == "delete" )
+        i = q.find( " from " );
+    if ( i >= 0 )
+        table = q.mid( i + 6 ).section( " ", 1 );
+    else if ( verb == "insert" )
+        table = q.section( " ", 3 );
+    else if ( verb == "update" || verb == "copy" || verb == "lock" )
+        table = q.section( " ", 2 );
+
+    EString r;
+    EString w = verb;
+    if ( !table.isEmpty() )
+        w = verb + "-" + table;
+    uint n = 0;
+    while ( n < w.length() && n < 40 ) {
+        char c = w[n];
+        if ( ( c >= 'a' && c <= 'z' ) || ( c >= '0' && c <= '9' ) )
+            r.append( c );
+        else if ( c == '-' || c == '_' )
+            r.append( '-' );
+        else
+            break;
+        n++;
+    }
+    if ( r.isEmpty() || r.endsWith( "-" ) )
+        r.append( "other" );
+    return r;
+}
 
 
-/*! Updates the statistics when \a q is done. */
+/*! Updates the statistics when \a q is done: The success/failure
+    counters, and histograms for the time \a q spent waiting (overall
+    and per Query::Priority class), until its first row and in
+    total. The total time is also recorded per query shape (as
+    "query-time-select-messages" etc.).
+
+    If \a q took longer than the slow-query-threshold, it's logged.
+*/
 
 void Postgres::countQueries( class Query * q )
 {
     if ( !goodQueries ) {
         goodQueries = new GraphableCounter( "queries-executed" ); // bad name?
         badQueries = new GraphableCounter( "queries-failed" ); // bad name?
+        waitTimes = new GraphableHistogram( "query-wait-time" );
+        firstRowTimes = new GraphableHistogram( "query-first-row-time" );
+        totalTimes = new GraphableHistogram( "query-time" );
     }
 
+    recordQueryTime( q );
+
     if ( !q->failed() )
         goodQueries->tick();
     else if ( !q->canFail() )
         badQueries->tick();
     ; // a query which fails but canFail is not counted anywhere.
 
-    // later also use GraphableDataSet to keep track of query
-    // execution times, but not right now.
+    uint total = q->totalTime();
+    waitTimes->addNumber( q->waitTime() );
+    Query::Priority p = q->priority();
+    if ( !classWaitTimes[p] )
+        classWaitTimes[p] =
+            new GraphableHistogram( EString( "query-wait-time-" ) +
+                                    Query::priorityName( p ) );
+    classWaitTimes[p]->addNumber( q->waitTime() );
+    firstRowTimes->addNumber( q->firstRowTime() );
+    totalTimes->addNumber( total );
+
+    EString n( "query-time-" + shape( q->string() ) );
+    GraphableHistogram * h = GraphableHistogram::find( n );
+    if ( !h && shapes < maxShapes ) {
+        shapes++;
+        h = new GraphableHistogram( n );
+    }
+    if ( h )
+        h->addNumber( total );
+
+    uint threshold =
+        Configuration::scalar( Configuration::SlowQueryThreshold );
+    if ( threshold && total / 1000 >= threshold ) {
+        uint parameters = 0;
+        if ( q->inputLines() )
+            parameters = q->inputLines()->count();
+        else if ( q->values() )
+            parameters = q->values()->count();
+        Scope x( q->log() );
+        log( "Slow query (" + fn( total / 1000 ) + "ms, of which " +
+             fn( q->waitTime() / 1000 ) + "ms waiting and " +
+             fn( q->firstRowTime() / 1000 ) + "ms to the first row) "
+             "on backend " + fn( connectionNumber() ) + " with " +
+             fn( parameters ) + " parameters: " + q->string(),
+             Log::Significant );
+    }
 }
 
 
@@ -1205,8 +1516,8 @@ private:
     PgKeyData * k;
 
 public:
-    PgCanceller( PgKeyData * key )
-        : Postgres(), k( key )
+    PgCanceller( PgKeyData * key, bool replica )
+        : Postgres( replica ), k( key )
     {
         log( "Sending cancel for pid " + fn( k->pid() ), Log::Debug );
     }
@@ -1236,5 +1547,11 @@ public:
 void Postgres::cancel( Query * q )
 {
     if ( d->queries.find( q ) )
-        (void)new PgCanceller( d->keydata );
+        (void)new PgCanceller( d->keydata, isReplica() );
+}
+
+
+List< Query > * Postgres::activeQueries()
+{
+    return &d->queries;
 }
@@ -12,7 +12,7 @@ class Postgres
     : public Database
 {
 public:
-    Postgres();
+    Postgres( bool = false );
     ~Postgres();
 
     void processQueue();
@@ -25,6 +25,7 @@ public:
     void sendListen();
 
     void cancel( Query * );
+    List< Query > * activeQueries();
 
 private:
     class PgData *d;
@@ -32,6 +33,8 @@ private:
     void processQuery( Query * );
     void authentication( char );
     void backendStartup( char );
+    void prepareHotStatements();
+    void setStatementTimeout( Query * );
     void process( char );
     void unknown( char );
     void serverMessage();
@@ -15,6 +15,20 @@
 #include "estringlist.h"
 #include "transaction.h"
 
+// gettimeofday
+#include <sys/time.h>
+
+
+/* Returns the current time in microseconds. */
+
+static int64 now()
+{
+    struct timeval tv;
+    if ( ::gettimeofday( &tv, 0 ) < 0 )
+        return 0;
+    return (int64)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
 
 class QueryData
     : public Garbage
@@ -24,7 +38,10 @@ public:
         : state( Query::Inactive ), format( Query::Text ),
           values( new Query::InputLine ), inputLines( 0 ),
           transaction( 0 ), owner( 0 ), totalRows( 0 ),
-          canFail( false )
+          canFail( false ), canBeSlow( false ),
+          priority( Query::Interactive ),
+          readOnly( false ), mailbox( 0 ), modseq( 0 ),
+          submitted( 0 ), executing( 0 ), firstRow( 0 ), finished( 0 )
     {}
 
     Query::State state;
@@ -45,6 +62,18 @@ public:
 
     bool canFail;
     bool canBeSlow;
+
+    Query::Priority priority;
+    EString submitter;
+
+    bool readOnly;
+    uint mailbox;
+    int64 modseq;
+
+    int64 submitted;
+    int64 executing;
+    int64 firstRow;
+    int64 finished;
 };
 
 
@@ -137,14 +166,95 @@ Query::State Query::state() const
 }
 
 
+/* Returns the ID of the Log which identifies the submitter of a
+   Query whose Log is \a l. See Query::submitter().
+*/
+
+static EString submitterOf( Log * l )
+{
+    if ( !l )
+        return "";
+    while ( l->parent() && l->parent()->parent() &&
+            l->parent()->parent()->parent() )
+        l = l->parent();
+    return l->id();
+}
+
+
 /*! Sets the state of this object to \a s.
     The initial state of each Query is Inactive, and the Database changes
     it to indicate the query's progress.
+
+    The time of each state change is recorded; see waitTime(),
+    firstRowTime() and totalTime().
 */
 
 void Query::setState( State s )
 {
     d->state = s;
+    switch ( s ) {
+    case Inactive:
+        break;
+    case Submitted:
+        d->submitted = now();
+        d->submitter = submitterOf( log() );
+        break;
+    case Executing:
+        d->executing = now();
+        break;
+    case Completed:
+    case Failed:
+        if ( !d->finished )
+            d->finished = now();
+        break;
+    }
+}
+
+
+/*! Returns the number of microseconds this Query waited between being
+    submitted and being sent to the database server. If it's still
+    waiting, returns how long it has waited so far, and if it hasn't
+    been submitted, 0.
+*/
+
+uint Query::waitTime() const
+{
+    if ( !d->submitted )
+        return 0;
+    if ( d->state == Submitted )
+        return (uint)( now() - d->submitted );
+    if ( d->executing < d->submitted )
+        return 0;
+    return (uint)( d->executing - d->submitted );
+}
+
+
+/*! Returns the number of microseconds between sending this Query to
+    the database server and the arrival of the first row (or the end
+    of the query, if it returned no rows). Returns 0 if neither has
+    happened yet.
+*/
+
+uint Query::firstRowTime() const
+{
+    int64 t = d->firstRow;
+    if ( !t )
+        t = d->finished;
+    if ( !d->executing || t < d->executing )
+        return 0;
+    return (uint)( t - d->executing );
+}
+
+
+/*! Returns the number of microseconds between submitting this Query
+    and its completion or failure, or 0 if it isn't done() yet.
+*/
+
+uint Query::totalTime() const
+{
+    if ( !d->submitted || d->finished < d->submitted )
+        return 0;
+    return (uint)( d->finished - d->submitted );
 }
 
 
@@ -217,6 +327,122 @@ void Query::setTransaction( Transaction *t )
 }
 
 
+/*! Records that this Query is of priority class \a p. The Database
+    uses this to decide which of the waiting queries to hand to an
+    idle handle: Interactive queries (the default) are preferred to
+    Delivery ones, which in turn are preferred to Background ones,
+    and some handles are kept for Interactive work only.
+
+    Queries which are part of a Transaction use the Transaction's
+    priority instead.
+*/
+
+void Query::setPriority( Priority p )
+{
+    d->priority = p;
+}
+
+
+/*! Returns the priority class of this Query, as set by setPriority()
+    or Transaction::setPriority().
+*/
+
+Query::Priority Query::priority() const
+{
+    if ( d->transaction )
+        return d->transaction->priority();
+    return d->priority;
+}
+
+
+/*! Records whether this Query is read-only, according to \a ro. A
+    read-only Query which isn't part of a Transaction may be sent to
+    the db-replica-address instead of the primary database server.
+
+    If \a mailbox is nonzero, the replica is used only if it has caught
+    up with the primary at least until the mailbox's nextmodseq was \a
+    modseq, so that a client never sees older data than it's already
+    been told about. (If it hasn't, the Query is sent to the primary.)
+
+    The default is false.
+*/
+
+void Query::setReadOnly( bool ro, uint mailbox, int64 modseq )
+{
+    d->readOnly = ro;
+    d->mailbox = mailbox;
+    d->modseq = modseq;
+}
+
+
+/*! Returns what setReadOnly() set: true if this Query may be sent to
+    a replica, false if not.
+*/
+
+bool Query::readOnly() const
+{
+    return d->readOnly;
+}
+
+
+/*! Returns the ID of the mailbox a replica must be up to date with in
+    order to run this Query, or 0 if there is no such requirement.
+    \sa setReadOnly() requiredModSeq()
+*/
+
+uint Query::requiredMailbox() const
+{
+    return d->mailbox;
+}
+
+
+/*! Returns the nextmodseq requiredMailbox() must have reached on a
+    replica in order to run this Query there. \sa setReadOnly()
+*/
+
+int64 Query::requiredModSeq() const
+{
+    return d->modseq;
+}
+
+
+/*! Returns a short name for \a p, suitable for use in graph names. */
+
+const char * Query::priorityName( Priority p )
+{
+    switch ( p ) {
+    case Interactive:
+        return "interactive";
+    case Delivery:
+        return "delivery";
+    case Background:
+        return "background";
+    }
+    return "interactive";
+}
+
+
+/*! Returns a string identifying the client on whose behalf this Query
+    is run, so the Database can share the handles fairly between
+    clients. This is the ID of the Log belonging to the client's
+    Connection (which is a child of its Listener's Log, which in turn
+    is a child of the server's own Log), or an empty string if the
+    Query has no owner.
+
+    Queries owned by something other than a client connection use
+    their own outermost Log.
+
+    The submitter is found when the Query is submitted, since the
+    Database looks at it each time it picks a query to run. Until
+    then, this function returns an empty string.
+*/
+
+EString Query::submitter() const
+{
+    return d->submitter;
+}
+
+
 /*! Returns this Query's format, which may be Text (the default) or
     Binary (set for "copy ... with binary" statements). */
 
@@ -560,6 +786,7 @@ void Query::notify()
 
     Scope s( d->owner->log() );
     try {
+        CallbackTimer t( d->owner );
         d->owner->execute();
     }
     catch ( const Exception& e ) {
@@ -731,6 +958,8 @@ bool Query::hasResults() const
 
 void Query::addRow( Row *r )
 {
+    if ( !d->totalRows )
+        d->firstRow = now();
     d->rows.append( r );
     d->totalRows++;
 }
@@ -34,6 +34,10 @@ public:
     bool failed() const;
     bool done() const;
 
+    uint waitTime() const;
+    uint firstRowTime() const;
+    uint totalTime() const;
+
     void cancel();
 
     bool canFail() const;
@@ -42,6 +46,18 @@ public:
     Transaction *transaction() const;
     void setTransaction( Transaction * );
 
+    enum Priority { Interactive, Delivery, Background };
+    void setPriority( Priority );
+    Priority priority() const;
+    static const char * priorityName( Priority );
+
+    EString submitter() const;
+
+    void setReadOnly( bool, uint = 0, int64 = 0 );
+    bool readOnly() const;
+    uint requiredMailbox() const;
+    int64 requiredModSeq() const;
+
     enum Format { Unknown = -1, Text = 0, Binary };
     Format format() const;
 
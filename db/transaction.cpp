@@ -19,7 +19,8 @@ public:
           children( 0 ),
           submittedCommit( false ), submittedBegin( false ),
           committing( false ),
-          owner( 0 ), db( 0 ), queries( 0 ), failedQuery( 0 )
+          owner( 0 ), db( 0 ), queries( 0 ), failedQuery( 0 ),
+          priority( Query::Interactive )
     {}
 
     Transaction::State state;
@@ -38,6 +39,8 @@ public:
     Query * failedQuery;
     EString error;
 
+    Query::Priority priority;
+
     class CommitBouncer
         : public EventHandler
     {
@@ -155,6 +158,31 @@ Transaction * Transaction::parent() const
 }
 
 
+/*! Records that this Transaction (and all its queries) is of priority
+    class \a p. The default is Query::Interactive. A subTransaction()
+    always has the same priority as its parent.
+
+    \sa Query::setPriority()
+*/
+
+void Transaction::setPriority( Query::Priority p )
+{
+    d->priority = p;
+}
+
+
+/*! Returns the priority class of this Transaction, as set by
+    setPriority().
+*/
+
+Query::Priority Transaction::priority() const
+{
+    if ( d->parent )
+        return d->parent->priority();
+    return d->priority;
+}
+
+
 /*! Sets this Transaction's Database handle to \a db.
 
     This function is used by the Database when the BEGIN is processed.
@@ -165,8 +193,9 @@ void Transaction::setDatabase( Database *db )
     d->db = db;
 
     Scope x( d->owner->log() );
-    log( "Using database connection " + fn( db->connectionNumber() ),
-         Log::Debug );
+    if ( Log::enabled( Log::Debug ) )
+        log( "Using database connection " + fn( db->connectionNumber() ),
+             Log::Debug );
 
     if ( d->queries )
         return;
@@ -607,6 +636,7 @@ void Transaction::notify()
         return;
     Scope s( d->owner->log() );
     try {
+        CallbackTimer t( d->owner );
         d->owner->execute();
     }
     catch ( const Exception& e ) {
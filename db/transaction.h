@@ -4,6 +4,7 @@
 #define TRANSACTION_H
 
 #include "list.h"
+#include "query.h"
 
 
 class Query;
@@ -46,6 +47,9 @@ public:
     Transaction * subTransaction( EventHandler * );
     Transaction * parent() const;
 
+    void setPriority( Query::Priority );
+    Query::Priority priority() const;
+
     void finalizeBegin( Query * );
     void finalizeTransaction( Query * );
 
@@ -309,6 +309,19 @@ Codec * Codec::byString( const UString & u )
 {
     uint i = 0;
     uint s = 0xffff;
+    const unsigned char * narrow = u.narrowData();
+    if ( narrow ) {
+        // every character is below U+0100, so we can skip the range
+        // check and look at the bytes directly. ASCII is supported
+        // by all the charsets, so runs of it change nothing.
+        while ( i < u.length() && s > 0 ) {
+            uint c = narrow[i++];
+            if ( c == 0 || c >= 128 )
+                s = s & charsetSupport[c];
+        }
+        if ( s == 0xffff && !u.isEmpty() )
+            s = charsetSupport['a'];
+    }
     while ( i < u.length() && s > 0 ) {
         if ( (uint)u[i] < lastSupportedChar )
             s = s & charsetSupport[u[i]];
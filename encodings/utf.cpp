@@ -5,6 +5,8 @@
 #include "estring.h"
 #include "ustring.h"
 
+#include <string.h> // memcpy
+
 
 /*! \class Utf8Codec utf.h
     The Utf8Codec class implements the codec described in RFC 2279
@@ -41,6 +43,35 @@ EString Utf8Codec::fromUnicode( const UString & u )
     EString r;
     r.reserve( u.length() + 40 );
     uint i = 0;
+
+    const unsigned char * narrow = u.narrowData();
+    if ( narrow ) {
+        // every code point is below U+0100, so we copy runs of ASCII
+        // as they are and need at most two bytes for the rest
+        while ( i < u.length() ) {
+            uint b = i;
+            while ( i < u.length() && narrow[i] < 0x80 &&
+                    ( narrow[i] || !pgutf ) )
+                i++;
+            if ( i > b )
+                r.append( (const char *)narrow + b, i - b );
+            if ( i < u.length() ) {
+                uint c = narrow[i];
+                if ( !c ) {
+                    r.append( 0xEE );
+                    r.append( 0xB4 );
+                    r.append( 0x80 );
+                }
+                else {
+                    r.append( 0xc0 | ((char)(c >> 6)) );
+                    r.append( 0x80 | ((char)(c & 0x3f)) );
+                }
+                i++;
+            }
+        }
+        return r;
+    }
+
     while ( i < u.length() ) {
         int c = u[i];
         if ( pgutf && !c ) {
@@ -112,19 +143,47 @@ static int pick( const EString & s, int i, uint l )
     return a;
 }
 
+/*! Returns the number of ASCII bytes at the start of the \a l bytes
+    at \a p. This looks at eight bytes at a time, since most of the
+    text we see is ASCII.
+*/
+
+static uint asciiPrefix( const unsigned char * p, uint l )
+{
+    uint i = 0;
+    while ( i + 8 <= l ) {
+        uint a;
+        uint b;
+        memcpy( &a, p + i, 4 );
+        memcpy( &b, p + i + 4, 4 );
+        if ( ( a | b ) & 0x80808080 )
+            break;
+        i += 8;
+    }
+    while ( i < l && p[i] < 0x80 )
+        i++;
+    return i;
+}
+
+
 /*! Decodes the UTF-8 string \a s and returns the result. */
 
 UString Utf8Codec::toUnicode( const EString & s )
 {
     UString u;
     u.reserve( s.length() );
+    const unsigned char * p = (const unsigned char *)s.data();
     uint i = 0;
     while ( i < s.length() ) {
         int c = 0;
-        if ( s[i] < 0x80 ) {
+        if ( p[i] < 0x80 ) {
             // 0000 0000-0000 007F   0xxxxxxx
-            c = s[i];
-            i += 1;
+            // ASCII needs no decoding, so we append the entire run
+            uint n = i + asciiPrefix( p + i, s.length() - i );
+            mangleTrailingSurrogate( u );
+            u.append( (const char *)p + i, n - i );
+            i = n;
+            continue;
         }
         else if ( (s[i] & 0xe0) == 0xc0 && ahead( s, i, 1 ) ) {
             // 0000 0080-0000 07FF   110xxxxx 10xxxxxx
@@ -153,11 +153,15 @@ void Acl::execute()
             return;
         }
         else if ( d->type == DeleteAcl ) {
+            setTransaction( new Transaction( this ) );
             d->q = new Query( "delete from permissions where "
                               "mailbox=$1 and identifier=$2", this );
             d->q->bind( 1, d->mailbox->id() );
             d->q->bind( 2, d->authid );
-            d->q->execute();
+            transaction()->enqueue( d->q );
+            transaction()->enqueue(
+                new Query( "notify permissions_updated", 0 ) );
+            transaction()->commit();
         }
         else if ( d->type == GetAcl ) {
             EString s;
@@ -255,8 +259,13 @@ void Acl::execute()
             }
 
             d->state = 4;
+            transaction()->enqueue(
+                new Query( "notify permissions_updated", 0 ) );
             transaction()->commit();
         }
+        else if ( d->type == DeleteAcl ) {
+            d->state = 4;
+        }
     }
 
     if ( d->state == 4 ) {
@@ -17,6 +17,7 @@
 #include "section.h"
 #include "message.h"
 #include "estring.h"
+#include "eventloop.h"
 #include "fetch.h"
 #include "imap.h"
 #include "list.h"
@@ -38,6 +39,22 @@ struct Textpart
 };
 
 
+class AppendParser
+    : public EventHandler
+{
+public:
+    AppendParser( Append * a ): turn( false ), append( a ) {
+        EventLoop::global()->defer( this );
+    }
+    void execute() {
+        turn = true;
+        append->execute();
+    }
+    bool turn;
+    Append * append;
+};
+
+
 struct Appendage
     : public Garbage
 {
@@ -45,7 +62,7 @@ struct Appendage
         : Garbage(),
           message( 0 ),
           textparts( 0 ), urlFetcher( 0 ),
-          annotations( 0 )
+          annotations( 0 ), parser( 0 )
     {}
     Injectee * message;
     List<Textpart> * textparts;
@@ -54,6 +71,7 @@ struct Appendage
     EStringList flags;
     List<Annotation> * annotations;
     Date date;
+    AppendParser * parser;
 };
 
 
@@ -386,6 +404,13 @@ void Append::process( class Appendage * h )
         return;
     }
 
+    // parsing may take a while, so we wait for the event loop to give
+    // this message a turn.
+    if ( !h->parser )
+        h->parser = new AppendParser( this );
+    if ( !h->parser->turn )
+        return;
+
     List<Textpart>::Iterator it( h->textparts );
     while ( it ) {
         Textpart * tp = it;
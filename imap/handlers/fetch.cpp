@@ -895,6 +895,7 @@ void Fetch::sendFetchQueries()
     }
 
     Fetcher * f = new Fetcher( l, this, imap() );
+    f->setReadOnly( session()->mailbox()->id(), session()->nextModSeq() );
     if ( d->needsAddresses && !haveAddresses )
         f->fetch( Fetcher::Addresses );
     if ( d->needsHeader && !haveHeader )
@@ -1083,33 +1084,58 @@ EString Fetch::sectionData( Section * s, Message * m, bool unicodable )
 }
 
 
-/* This function returns the response data for an element in
-   d->sections, to be included in the FETCH response by
-   fetchResponses() below. If \a unicode is false, the result will be
-   downgraded rather than contain unicode.
+// section data longer than this is sent as a literal which
+// makeFetchResponse() doesn't copy into the rest of the response
+static const uint largeLiteral = 16384;
+
+
+/* This function appends the response data for an element in
+   d->sections to \a r, to be included in the FETCH response by
+   makeFetchResponse() below. If \a unicode is false, the result will
+   be downgraded rather than contain unicode.
+
+   If the data is large, sectionResponse() appends the literal's
+   prefix to \a r, moves \a r to \a l and appends the data to \a l
+   too, leaving \a r empty.
 */
 
-static EString sectionResponse( Section * s, Message * m, bool unicode )
+static void sectionResponse( EStringList * l, EString & r,
+                             Section * s, Message * m, bool unicode )
 {
     EString data( Fetch::sectionData( s, m, unicode ) );
-    if ( !s->item.startsWith( "BINARY.SIZE" ) )
-        data = Command::imapQuoted( data, Command::NString );
-    EString r;
-    r.reserve( data.length() + s->item.length() + 1 );
     r.append( s->item );
     r.append( " " );
-    r.append( data );
-    return r;
+    if ( s->item.startsWith( "BINARY.SIZE" ) ) {
+        r.append( data );
+    }
+    else if ( data.length() <= largeLiteral ) {
+        r.append( Command::imapQuoted( data, Command::NString ) );
+    }
+    else {
+        // if there's a null byte, we need to send a literal8
+        if ( data.contains( 0 ) )
+            r.append( '~' );
+        r.append( '{' );
+        r.appendNumber( data.length() );
+        r.append( "}\r\n" );
+        l->append( r );
+        l->append( data );
+        r.truncate();
+    }
 }
 
 
 /*! Emits a single FETCH response for the message \a m, which is
     trusted to have UID \a uid and MSN \a msn.
 
+    The response is returned as a list of strings which form the
+    response when concatenated. Large literals are separate strings,
+    so they needn't be copied.
+
     The message must have all necessary content.
 */
 
-EString Fetch::makeFetchResponse( Message * m, uint uid, uint msn )
+EStringList * Fetch::makeFetchResponse( Message * m, uint uid, uint msn )
 {
     EStringList l;
     if ( d->uid )
@@ -1139,21 +1165,28 @@ EString Fetch::makeFetchResponse( Message * m, uint uid, uint msn )
             l.append( "MODSEQ (" + fn( dd->modseq ) + ")" );
     }
 
-    List< Section >::Iterator it( d->sections );
-    bool unicode = imap()->clientSupports( IMAP::Unicode );
-    while ( it ) {
-        l.append( sectionResponse( it, m, unicode ) );
-        ++it;
-    }
-
+    EStringList * parts = new EStringList;
     EString r;
     EString payload = l.join( " " );
     r.reserve( payload.length() + 30 );
     r.appendNumber( msn );
     r.append( " FETCH (" );
     r.append( payload );
+
+    List< Section >::Iterator it( d->sections );
+    bool unicode = imap()->clientSupports( IMAP::Unicode );
+    bool first = l.isEmpty();
+    while ( it ) {
+        if ( !first )
+            r.append( " " );
+        first = false;
+        sectionResponse( parts, r, it, m, unicode );
+        ++it;
+    }
+
     r.append( ")" );
-    return r;
+    parts->append( r );
+    return parts;
 }
 
 
@@ -1771,11 +1804,21 @@ ImapFetchResponse::ImapFetchResponse( ImapSession * s,
 
 
 EString ImapFetchResponse::text() const
+{
+    return textParts()->join( "" );
+}
+
+
+/*! Returns the response as Fetch::makeFetchResponse() made it, so
+    that large literals aren't copied.
+*/
+
+EStringList * ImapFetchResponse::textParts() const
 {
     uint msn = session()->msn( u );
     if ( u && msn )
         return f->makeFetchResponse( f->message( u ), u, msn );
-    return "";
+    return new EStringList;
 }
 
 
@@ -33,7 +33,7 @@ public:
     EString annotation( class User *, uint,
                        const EStringList &, const EStringList & );
 
-    EString makeFetchResponse( Message *, uint, uint );
+    EStringList * makeFetchResponse( Message *, uint, uint );
 
     Message * message( uint ) const;
     void forget( uint );
@@ -67,6 +67,7 @@ class ImapFetchResponse
 public:
     ImapFetchResponse( ImapSession *, Fetch *, uint );
     EString text() const;
+    EStringList * textParts() const;
     void setSent();
 
 private:
@@ -449,6 +449,7 @@ void Search::execute()
 
         d->query = d->root->query( imap()->user(), s->mailbox(),
                                    s, this, false );
+        d->query->setReadOnly( true, s->mailbox()->id(), s->nextModSeq() );
         d->query->execute();
     }
 
@@ -496,9 +497,10 @@ void Search::considerCache()
     else if ( d->root->field() == Selector::Uid &&
               d->root->action() == Selector::Contains ) {
         d->matches = s->messages().intersection( d->root->messageSet() );
-        log( "UID-only search matched " +
-             fn( d->matches.count() ) + " messages",
-             Log::Debug );
+        if ( Log::enabled( Log::Debug ) )
+            log( "UID-only search matched " +
+                 fn( d->matches.count() ) + " messages",
+                 Log::Debug );
     }
     else {
         uint max = s->count();
@@ -516,16 +518,18 @@ void Search::considerCache()
             case Selector::No:
                 break;
             case Selector::Punt:
-                log( "Search must go to database: message " + fn( uid ) +
-                     " could not be tested in RAM",
-                     Log::Debug );
+                if ( Log::enabled( Log::Debug ) )
+                    log( "Search must go to database: message " +
+                         fn( uid ) + " could not be tested in RAM",
+                         Log::Debug );
                 needDb = true;
                 d->matches.clear();
                 break;
             }
         }
-        log( "Search considered " + fn( c ) + " of " + fn( max ) +
-             " messages using cache", Log::Debug );
+        if ( Log::enabled( Log::Debug ) )
+            log( "Search considered " + fn( c ) + " of " + fn( max ) +
+                 " messages using cache", Log::Debug );
     }
     if ( !needDb )
         d->done = true;
@@ -317,6 +317,8 @@ void Status::execute()
                          "from mailbox_messages "
                          "where mailbox=$1 and not seen", this );
         d->unseenCount->bind( 1, d->mailbox->id() );
+        d->unseenCount->setReadOnly( true, d->mailbox->id(),
+                                  d->mailbox->nextModSeq() );
         d->unseenCount->execute();
     }
 
@@ -335,6 +337,8 @@ void Status::execute()
                          "uidnext-first_recent as recent "
                          "from mailboxes where id=$1", this );
         d->recentCount->bind( 1, d->mailbox->id() );
+        d->recentCount->setReadOnly( true, d->mailbox->id(),
+                                  d->mailbox->nextModSeq() );
         d->recentCount->execute();
     }
 
@@ -353,6 +357,8 @@ void Status::execute()
                          "$1::int as mailbox "
                          "from mailbox_messages where mailbox=$1", this );
         d->messageCount->bind( 1, d->mailbox->id() );
+        d->messageCount->setReadOnly( true, d->mailbox->id(),
+                                  d->mailbox->nextModSeq() );
         d->messageCount->execute();
     }
 
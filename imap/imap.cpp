@@ -10,6 +10,7 @@
 #include "buffer.h"
 #include "estring.h"
 #include "mailbox.h"
+#include "estringlist.h"
 #include "selector.h"
 #include "eventloop.h"
 #include "transaction.h"
@@ -18,6 +19,7 @@
 #include "handlers/capability.h"
 #include "mailboxgroup.h"
 #include "imapparser.h"
+#include "spoolfile.h"
 #include "database.h"
 #include "eventmap.h"
 #include "command.h"
@@ -31,6 +33,11 @@
 static bool endsWithLiteral( const EString *, uint *, bool * );
 
 
+// responses longer than this are written in chunks of this size, as
+// the write buffer makes room for them
+static const uint streamingChunk = 65536;
+
+
 class IMAPData
     : public Garbage
 {
@@ -40,11 +47,12 @@ public:
           prefersAbsoluteMailboxes( false ),
           runningCommands( false ), runCommandsAgain( false ),
           readingLiteral( false ),
-          literalSize( 0 ), mailbox( 0 ),
+          literalSize( 0 ), spool( 0 ), spooled( 0 ), mailbox( 0 ),
           bytesArrived( 0 ),
           eventMap( new EventMap ),
           lastBadTime( 0 ),
-          nextOkTime( 0 )
+          nextOkTime( 0 ),
+          streamed( 0 ), streamedParts( 0 ), streamedOffset( 0 )
     {
         uint i = 0;
         while ( i < IMAP::NumClientCapabilities )
@@ -70,6 +78,8 @@ public:
     bool runCommandsAgain;
     bool readingLiteral;
     uint literalSize;
+    SpoolFile * spool;
+    Map<EString> * spooled;
 
     List<Command> commands;
     List<ImapResponse> responses;
@@ -110,6 +120,11 @@ public:
     };
 
     uint nextOkTime;
+
+    ImapResponse * streamed;
+    EStringList * streamedParts;
+    uint streamedOffset;
+    EString held;
 };
 
 
@@ -214,9 +229,11 @@ void IMAP::react( Event e )
                 ++i;
                 if ( c->state() == Command::Unparsed ||
                      c->state() == Command::Blocked ||
-                     c->state() == Command::Executing )
+                     c->state() == Command::Executing ) {
+                    Database::cancelQueries( c->log() );
                     c->error( Command::No,
                               "Unexpected close by client" );
+                }
             }
         }
         break;
@@ -282,6 +299,8 @@ void IMAP::parse()
                 if ( n <= ImapParser::literalSizeLimit() ) {
                     d->readingLiteral = true;
                     d->literalSize = n;
+                    if ( SpoolFile::enabled() && n > SpoolFile::threshold() )
+                        d->spool = new SpoolFile;
                     if ( !plus )
                         enqueue( "+ reading literal\r\n" );
                 }
@@ -291,8 +310,28 @@ void IMAP::parse()
             if ( !d->readingLiteral ) {
                 addCommand();
                 d->str.truncate();
+                d->spooled = 0;
             }
         }
+        else if ( d->readingLiteral && d->spool ) {
+            // A large literal goes to disk as it arrives, and the
+            // ImapParser picks it up from there.
+            uint n = d->literalSize - d->spool->size();
+            if ( n > r->size() )
+                n = r->size();
+            d->spool->append( r->string( n ) );
+            r->remove( n );
+            if ( d->spool->size() < d->literalSize )
+                return;
+
+            if ( !d->spooled )
+                d->spooled = new Map<EString>;
+            d->spooled->insert( d->str.length(),
+                                new EString( d->spool->contents() ) );
+            d->spool->close();
+            d->spool = 0;
+            d->readingLiteral = false;
+        }
         else if ( d->readingLiteral ) {
             // Have we finished reading a complete literal?
             if ( r->size() < d->literalSize )
@@ -324,6 +363,7 @@ void IMAP::addCommand()
         d->str = "arnt logout";
 
     ImapParser * p = new ImapParser( d->str );
+    p->setSpooledLiterals( d->spooled );
 
     EString tag = p->tag();
     if ( !p->ok() ) {
@@ -873,6 +913,12 @@ void IMAP::emitResponses()
 
     bool any = false;
 
+    if ( d->streamed ) {
+        if ( !streamResponse() )
+            return;
+        any = true;
+    }
+
     Buffer * w = writeBuffer();
     List<ImapResponse>::Iterator r( d->responses );
     uint n = 0;
@@ -881,15 +927,39 @@ void IMAP::emitResponses()
             r->setSent();
         }
         else if ( !r->sent() && ( can || !r->changesMsn() ) ) {
-            EString t = r->text();
-            if ( !t.isEmpty() ) {
+            if ( writeBufferFull() )
+                break;
+            EStringList * t = r->textParts();
+            uint length = 0;
+            EStringList::Iterator i( t );
+            while ( i ) {
+                length += i->length();
+                ++i;
+            }
+            any = true;
+            if ( !length ) {
+                r->setSent();
+            }
+            else if ( length > streamingChunk ) {
                 w->append( "* ", 2 );
-                w->append( t );
+                n++;
+                d->streamed = r;
+                d->streamedParts = t;
+                d->streamedOffset = 0;
+                if ( !streamResponse() )
+                    break;
+            }
+            else {
+                w->append( "* ", 2 );
+                EStringList::Iterator j( t );
+                while ( j ) {
+                    w->append( *j );
+                    ++j;
+                }
                 w->append( "\r\n", 2 );
                 n++;
+                r->setSent();
             }
-            r->setSent();
-            any = true;
         }
         if ( r->sent() )
             d->responses.take( r );
@@ -908,6 +978,86 @@ void IMAP::emitResponses()
 }
 
 
+/*! Appends as much as the writeBuffer() can hold of the response
+    emitResponses() is currently streaming, and returns true if that
+    completes the response, or false if there's more to write when the
+    buffer has drained.
+
+    Anything enqueue()d meanwhile is written once the response is
+    complete.
+*/
+
+bool IMAP::streamResponse()
+{
+    Buffer * w = writeBuffer();
+    EStringList * parts = d->streamedParts;
+    while ( !parts->isEmpty() && !writeBufferFull() ) {
+        EString * p = parts->firstElement();
+        uint n = p->length() - d->streamedOffset;
+        if ( n > streamingChunk )
+            n = streamingChunk;
+        w->append( p->data() + d->streamedOffset, n );
+        d->streamedOffset += n;
+        if ( d->streamedOffset >= p->length() ) {
+            parts->shift();
+            d->streamedOffset = 0;
+        }
+    }
+    if ( !parts->isEmpty() )
+        return false;
+
+    w->append( "\r\n", 2 );
+    d->streamed->setSent();
+    d->streamed = 0;
+    d->streamedParts = 0;
+    d->streamedOffset = 0;
+    if ( !d->held.isEmpty() ) {
+        w->append( d->held );
+        d->held.truncate();
+    }
+    return true;
+}
+
+
+/*! Appends \a s to the writeBuffer(), or if a large response is being
+    streamed, holds \a s back until that response has been completely
+    written.
+*/
+
+void IMAP::enqueue( const EString & s )
+{
+    if ( d->streamed )
+        d->held.append( s );
+    else
+        Connection::enqueue( s );
+}
+
+
+/*! Closes the connection, and discards any literal that's being
+    spooled to disk.
+*/
+
+void IMAP::close()
+{
+    if ( d && d->spool ) {
+        d->spool->close();
+        d->spool = 0;
+    }
+    SaslConnection::close();
+}
+
+
+/*! Resumes emitting responses once the client has read most of what
+    emitResponses() had queued.
+*/
+
+void IMAP::writeBufferDrained()
+{
+    emitResponses();
+    unblockCommands();
+}
+
+
 /*! Records that \a m is a (possibly) active mailbox group. */
 
 void IMAP::addMailboxGroup( MailboxGroup * m )
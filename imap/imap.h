@@ -54,6 +54,11 @@ public:
     void respond( class ImapResponse * );
     void emitResponses();
 
+    void enqueue( const EString & );
+    void writeBufferDrained();
+
+    void close();
+
     void addMailboxGroup( MailboxGroup * );
     void removeMailboxGroup( MailboxGroup * );
     MailboxGroup * mostLikelyGroup( Mailbox *, uint );
@@ -72,6 +77,7 @@ private:
     void addCommand();
     void runCommands();
     void run( Command * );
+    bool streamResponse();
 };
 
 
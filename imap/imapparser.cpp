@@ -22,11 +22,22 @@
 */
 
 ImapParser::ImapParser( const EString &s )
-    : AbnfParser( s )
+    : AbnfParser( s ), spooled( 0 )
 {
 }
 
 
+/*! Records that the literals in \a literals were spooled by IMAP
+    instead of being included in the parsed string. Each is keyed by
+    the position where its contents would have started.
+*/
+
+void ImapParser::setSpooledLiterals( Map<EString> * literals )
+{
+    spooled = literals;
+}
+
+
 /*! Returns the first line of this IMAP command, meant for logging.
 
     This function assumes that the object was constructed for the entire
@@ -222,7 +233,8 @@ EString ImapParser::quoted()
 
     This function depends on the IMAP parser to insert the CRLF before
     the literal's contents, and to ensure that the literal's contents
-    are the right size.
+    are the right size. Large literals may instead have been spooled,
+    see setSpooledLiterals().
 */
 
 EString ImapParser::literal()
@@ -258,6 +270,12 @@ EString ImapParser::literal()
     if ( !ok() )
         return "";
 
+    if ( spooled ) {
+        EString * s = spooled->find( pos() );
+        if ( s && s->length() == len )
+            return *s;
+    }
+
     EString r( str.mid( pos(), len ) );
     step( len );
     return r;
@@ -5,6 +5,7 @@
 
 #include "abnfparser.h"
 #include "integerset.h"
+#include "map.h"
 
 
 class ImapParser
@@ -30,7 +31,12 @@ public:
     EString flag();
     EString dotLetters( uint, uint );
 
+    void setSpooledLiterals( Map<EString> * );
+
     static uint literalSizeLimit();
+
+private:
+    Map<EString> * spooled;
 };
 
 
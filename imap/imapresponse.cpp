@@ -3,6 +3,7 @@
 #include "imapresponse.h"
 
 #include "imapsession.h"
+#include "estringlist.h"
 #include "imap.h"
 
 
@@ -145,6 +146,26 @@ EString ImapResponse::text() const
 }
 
 
+/*! Returns text() as a list of strings which, concatenated, form the
+    response. This implementation returns a list containing just
+    text(), or an empty list if text() is empty.
+
+    Subclasses whose responses may contain large literals can
+    reimplement this to return the literal's data as a separate
+    string, so that IMAP can send it without first copying it into
+    one large string along with the rest of the response.
+*/
+
+EStringList * ImapResponse::textParts() const
+{
+    EStringList * r = new EStringList;
+    EString t = text();
+    if ( !t.isEmpty() )
+        r->append( t );
+    return r;
+}
+
+
 /*! Returns true if this response has meaning, and false if it may be
     discarded.
 
@@ -20,6 +20,7 @@ public:
     virtual void setSent();
 
     virtual EString text() const;
+    virtual class EStringList * textParts() const;
 
     virtual bool meaningful() const;
     bool changesMsn() const;
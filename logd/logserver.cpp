@@ -16,6 +16,8 @@
 #include <unistd.h>
 // openlog, syslog
 #include <syslog.h>
+// localtime
+#include <time.h>
 
 
 static uint id;
@@ -30,17 +32,35 @@ static bool useSyslog;
 
     Each logged item belongs to a transaction (a base-36 number), has a
     level of seriousness (debug, info, error or disaster) and a text.
+
+    Clients initially use a line-based text protocol (see
+    processLine()). A client may send "binary" to switch to a framed
+    binary protocol. Each frame starts with a four-byte big-endian
+    length, and contains any number of records, each of which is:
+
+    A one-byte Log::Severity, the time as four bytes of seconds since
+    the epoch and two of milliseconds, a two-byte length and the
+    client identifier, and a four-byte length and the message.
+
+    An empty frame means that the client is shutting down. The output
+    from each frame is written to the log file with a single write.
 */
 
 class LogServerData
     : public Garbage
 {
 public:
-    LogServerData(): id( ::id++ ), name( "(Anonymous)" ) {}
+    LogServerData()
+        : id( ::id++ ), name( "(Anonymous)" ),
+          binary( false ), batching( false ) {}
 
     uint id;
 
     EString name;
+
+    bool binary;
+    bool batching;
+    EString batch;
 };
 
 
@@ -86,9 +106,113 @@ void LogServer::react( Event e )
 
 void LogServer::parse()
 {
-    EString *s;
-    while ( ( s = readBuffer()->removeLine() ) != 0 )
-        processLine( *s );
+    while ( state() != Closing && state() != Invalid ) {
+        if ( d->binary ) {
+            if ( !processFrame() )
+                return;
+        }
+        else {
+            EString * s = readBuffer()->removeLine();
+            if ( !s )
+                return;
+            processLine( *s );
+        }
+    }
+}
+
+
+/* Returns the \a bytes-byte big-endian number at \a i in \a s. */
+
+static uint number( const EString & s, uint i, uint bytes )
+{
+    uint n = 0;
+    while ( bytes ) {
+        n = ( n << 8 ) + (unsigned char)s[i++];
+        bytes--;
+    }
+    return n;
+}
+
+
+/* Returns \a sec and \a ms formatted as in the text protocol. The
+   formatting is cached per second, since that's the common case.
+*/
+
+static EString timestamp( uint sec, uint ms )
+{
+    static uint last = 0;
+    static char result[32];
+    if ( sec != last || !last ) {
+        time_t t = sec;
+        struct tm * tm = localtime( &t );
+        sprintf( result, "%04d-%02d-%02d %02d:%02d:%02d.",
+                 tm->tm_year + 1900, tm->tm_mon+1, tm->tm_mday,
+                 tm->tm_hour, tm->tm_min, tm->tm_sec );
+        last = sec;
+    }
+    EString r( result );
+    if ( ms < 100 )
+        r.append( '0' );
+    if ( ms < 10 )
+        r.append( '0' );
+    r.appendNumber( ms );
+    return r;
+}
+
+
+/*! Processes one binary frame from the input buffer, and returns true
+    if it found one, or false if the buffer holds less than a complete
+    frame.
+*/
+
+bool LogServer::processFrame()
+{
+    Buffer * r = readBuffer();
+    if ( r->size() < 4 )
+        return false;
+    uint l = number( r->string( 4 ), 0, 4 );
+    if ( r->size() < l + 4 )
+        return false;
+    r->remove( 4 );
+    if ( !l ) {
+        close();
+        return false;
+    }
+    EString f = r->string( l );
+    r->remove( l );
+
+    d->batching = true;
+    uint i = 0;
+    while ( i + 13 <= l ) {
+        Log::Severity s = (Log::Severity)(unsigned char)f[i];
+        uint sec = number( f, i + 1, 4 );
+        uint ms = number( f, i + 5, 2 );
+        uint il = number( f, i + 7, 2 );
+        uint m = i + 13 + il;
+        if ( m > l )
+            break;
+        uint ml = number( f, i + 9 + il, 4 );
+        if ( m + ml > l )
+            break;
+        if ( s >= logLevel ) {
+            EString line( timestamp( sec, ms ) );
+            line.reserve( line.length() + ml + 1 );
+            line.append( ' ' );
+            line.append( f.mid( m, ml ) );
+            if ( line.contains( '\n' ) || line.contains( '\r' ) )
+                line = line.simplified();
+            output( f.mid( i + 9, il ), s, line );
+        }
+        i = m + ml;
+    }
+    d->batching = false;
+
+    if ( logFile )
+        logFile->write( d->batch );
+    else if ( !d->batch.isEmpty() )
+        fprintf( stderr, "%s", d->batch.cstr() );
+    d->batch.truncate();
+    return true;
 }
 
 
@@ -109,6 +233,10 @@ void LogServer::processLine( const EString &line )
         close();
         return;
     }
+    else if ( line == "binary" ) {
+        d->binary = true;
+        return;
+    }
 
     uint cmd = 0;
     uint msg = 0;
@@ -191,7 +319,9 @@ void LogServer::output( EString tag, Log::Severity s,
     msg.append( line );
     msg.append( "\n" );
 
-    if ( logFile )
+    if ( d->batching )
+        d->batch.append( msg );
+    else if ( logFile )
         logFile->write( msg );
     else
         fprintf( stderr, "%s", msg.cstr() );
@@ -16,6 +16,7 @@ public:
     void react(Event e);
 
     void processLine( const EString & );
+    bool processFrame();
 
     static void setLogFile( const EString &, const EString & );
     static void setLogLevel( const EString & );
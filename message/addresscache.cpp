@@ -0,0 +1,145 @@
+// Copyright 2009 The Archiveopteryx Developers <info@aox.org>
+
+#include "addresscache.h"
+
+#include "helperrowcreator.h"
+#include "allocator.h"
+#include "address.h"
+#include "dbsignal.h"
+#include "server.h"
+#include "graph.h"
+#include "event.h"
+#include "dict.h"
+#include "list.h"
+
+
+static class AddressCache * c = 0;
+static GraphableCounter * hits = 0;
+static GraphableCounter * misses = 0;
+
+// the largest number of addresses we keep. each costs about 100
+// bytes, and a server normally sees far fewer distinct addresses.
+static const uint maximum = 16384;
+
+
+class AddressCacheData
+    : public Garbage
+{
+public:
+    AddressCacheData(): Garbage() {}
+    Dict<uint> ids;
+    List<EString> order;
+};
+
+
+class AddressCacheForgetter
+    : public EventHandler
+{
+public:
+    AddressCacheForgetter(): EventHandler() {}
+    void execute() { AddressCache::forget(); }
+};
+
+
+/*! \class AddressCache addresscache.h
+
+    The AddressCache class remembers the database IDs of addresses
+    that AddressCreator has looked up or created, so that mail from
+    and to the usual senders and recipients needn't query the
+    addresses table for each message.
+
+    The cache is keyed by AddressCreator::key(), so two addresses
+    which the database considers equal (the localpart and domain are
+    compared case-insensitively, the name exactly) share an entry.
+
+    At most a fixed number of addresses are kept; when the cache is
+    full, the oldest entries are discarded first. Since rows in the
+    addresses table can be deleted by "aox vacuum", forget() discards
+    everything. It is called whenever the database sends an
+    "addresses_deleted" notification, and by the Injector when an
+    injection fails.
+*/
+
+
+/*! Constructs an empty AddressCache. Should not be called directly,
+    only via insert().
+*/
+
+AddressCache::AddressCache()
+    : Cache( 10 ), d( new AddressCacheData )
+{
+    (void)new DatabaseSignal( "addresses_deleted",
+                              new AddressCacheForgetter );
+}
+
+
+/*! Records that \a a has the database ID a->id(). Does nothing if \a
+    a has no ID yet.
+*/
+
+void AddressCache::insert( Address * a )
+{
+    if ( !a->id() || !Server::useCache() )
+        return;
+    if ( !c )
+        c = new AddressCache;
+
+    EString k = AddressCreator::key( a );
+    uint * id = c->d->ids.find( k );
+    if ( id ) {
+        *id = a->id();
+        return;
+    }
+
+    while ( c->d->order.count() >= maximum )
+        c->d->ids.remove( *c->d->order.shift() );
+
+    id = (uint*)Allocator::alloc( sizeof( uint ), 0 );
+    *id = a->id();
+    c->d->ids.insert( k, id );
+    c->d->order.append( new EString( k ) );
+}
+
+
+/*! Looks for \a a in the cache. If it's there, lookup() sets a->id()
+    and returns true. If not, lookup() returns false.
+*/
+
+bool AddressCache::lookup( Address * a )
+{
+    if ( !Server::useCache() )
+        return false;
+
+    if ( !::hits ) {
+        ::hits = new GraphableCounter( "address-cache-hits" );
+        ::misses = new GraphableCounter( "address-cache-misses" );
+    }
+
+    uint * id = 0;
+    if ( c )
+        id = c->d->ids.find( AddressCreator::key( a ) );
+    if ( !id ) {
+        ::misses->tick();
+        return false;
+    }
+
+    ::hits->tick();
+    a->setId( *id );
+    return true;
+}
+
+
+/*! Discards all cached addresses. */
+
+void AddressCache::forget()
+{
+    if ( c )
+        c->clear();
+}
+
+
+void AddressCache::clear()
+{
+    d->ids.clear();
+    d->order.clear();
+}
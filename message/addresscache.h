@@ -0,0 +1,29 @@
+// Copyright 2009 The Archiveopteryx Developers <info@aox.org>
+
+#ifndef ADDRESSCACHE_H
+#define ADDRESSCACHE_H
+
+#include "cache.h"
+
+class Address;
+
+
+class AddressCache
+    : public Cache
+{
+private:
+    AddressCache();
+
+public:
+    static void insert( Address * );
+    static bool lookup( Address * );
+    static void forget();
+
+    void clear();
+
+private:
+    class AddressCacheData * d;
+};
+
+
+#endif
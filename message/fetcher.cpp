@@ -40,6 +40,7 @@ public:
           batchSize( 0 ),
           uniqueDatabaseIds( true ),
           lastBatchStarted( 0 ),
+          readOnly( false ), mailbox( 0 ), modseq( 0 ),
           addresses( 0 ), otherheader( 0 ),
           body( 0 ), trivia( 0 ),
           partnumbers( 0 ),
@@ -59,6 +60,10 @@ public:
     bool uniqueDatabaseIds;
     uint lastBatchStarted;
 
+    bool readOnly;
+    uint mailbox;
+    int64 modseq;
+
     class Decoder
         : public EventHandler
     {
@@ -916,14 +921,33 @@ void Fetcher::setTransaction( class Transaction * t )
 }
 
 
+/*! Records that the queries done by this Fetcher may be sent to a
+    read-only replica, provided that it has caught up with \a mailbox
+    until \a modseq. This has no effect if setTransaction() is used.
+
+    \sa Query::setReadOnly()
+*/
+
+void Fetcher::setReadOnly( uint mailbox, int64 modseq )
+{
+    d->readOnly = true;
+    d->mailbox = mailbox;
+    d->modseq = modseq;
+}
+
+
 /*! This internal helper makes sure \a q is executed by the
     database.
 */
 
 void Fetcher::submit( Query * q )
 {
-    if ( d->transaction )
+    if ( d->transaction ) {
         d->transaction->enqueue( q );
-    else
+    }
+    else {
+        if ( d->readOnly )
+            q->setReadOnly( true, d->mailbox, d->modseq );
         q->execute();
+    }
 }
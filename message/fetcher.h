@@ -43,6 +43,7 @@ public:
     bool done() const;
 
     void setTransaction( class Transaction * );
+    void setReadOnly( uint, int64 );
 
 private:
     class FetcherData * d;
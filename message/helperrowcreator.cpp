@@ -6,6 +6,7 @@
 #include "scope.h"
 #include "allocator.h"
 #include "transaction.h"
+#include "addresscache.h"
 #include "address.h"
 #include "query.h"
 #include "flag.h"
@@ -436,6 +437,11 @@ Query * AnnotationNameCreator::makeCopy()
     You have to create an object, then execute it. It'll use a
     subtransaction and implicitly block your transaction until the IDs
     are known.
+
+    The IDs of addresses which already existed are recorded in the
+    AddressCache at once. Those of addresses this object inserted
+    aren't, since the rows may never be committed; they're available
+    via created(), so the owner can record them after committing.
 */
 
 
@@ -567,8 +573,14 @@ void AddressCreator::processSelect( Query * q )
                          r->getUString( "localpart" ),
                          r->getUString( "domain" ) );
         Address * our = a->find( key( c ) );
-        if ( our )
+        if ( our ) {
             our->setId( r->getInt( "id" ) );
+            bool existed = bulk ? r->getBoolean( "f" ) : !inserted();
+            if ( existed )
+                AddressCache::insert( our );
+            else
+                fresh.append( our );
+        }
         else
             log( "Unexpected result from db: " + c->toString( false ) );
     }
@@ -632,8 +644,8 @@ void AddressCreator::execute()
     if ( !decided ) {
         uint c = 0;
         Dict<Address>::Iterator i( a );
-        while ( c < useTempTable && i ) {
-            if ( !i->id() )
+        while ( i ) {
+            if ( !i->id() && !AddressCache::lookup( i ) )
                 ++c;
             ++i;
         }
@@ -705,7 +717,8 @@ void AddressCreator::execute()
         return;
 
     if ( !obtain ) {
-        obtain = new Query( "select id, name, localpart::text, domain::text "
+        obtain = new Query( "select id, f, name, "
+                            "localpart::text, domain::text "
                             "from na", this );
         sub->enqueue( obtain );
         sub->enqueue( new Query( "drop table na", 0 ) );
@@ -716,6 +729,18 @@ void AddressCreator::execute()
 }
 
 
+/*! Returns a pointer to the addresses this AddressCreator inserted
+    into the addresses table, which are valid only once the
+    Transaction is committed. The list may be empty, but the pointer
+    is never null.
+*/
+
+List<Address> * AddressCreator::created()
+{
+    return &fresh;
+}
+
+
 /*! \class ThreadRootCreator helperrowcreator.h
 
     The ThreadRootCreator class thread_roots rows. The only particular
@@ -97,6 +97,8 @@ public:
 
     void execute();
 
+    List<Address> * created();
+
 private:
     Query * makeSelect();
     void processSelect( Query * );
@@ -108,6 +110,7 @@ private:
 private:
     Dict<Address> * a;
     List<Address> asked;
+    List<Address> fresh;
     bool bulk;
     bool decided;
     Transaction * base;
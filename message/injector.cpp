@@ -15,9 +15,12 @@
 #include "datefield.h"
 #include "mimefields.h"
 #include "messagecache.h"
+#include "addresscache.h"
 #include "helperrowcreator.h"
 #include "addressfield.h"
 #include "transaction.h"
+#include "configuration.h"
+#include "allocator.h"
 #include "annotation.h"
 #include "postgres.h"
 #include "session.h"
@@ -76,11 +79,12 @@ public:
           state( Inactive ), failed( false ), retried( 0 ), transaction( 0 ),
           mailboxesCreated( 0 ),
           fieldNameCreator( 0 ), flagCreator( 0 ), annotationNameCreator( 0 ),
+          addressCreator( 0 ),
           lockUidnext( 0 ), select( 0 ), insert( 0 ),
           substate( 0 ), subtransaction( 0 ),
           findParents( 0 ), findReferences( 0 ),
           findBlah( 0 ), findMessagesInOutlookThreads( 0 ),
-          threads( 0 )
+          threads( 0 ), queued( false ), solo( false )
     {}
 
     struct Delivery
@@ -128,6 +132,7 @@ public:
     HelperRowCreator * fieldNameCreator;
     HelperRowCreator * flagCreator;
     HelperRowCreator * annotationNameCreator;
+    AddressCreator * addressCreator;
 
     Query * lockUidnext;
     Query * select;
@@ -194,9 +199,121 @@ public:
     };
 
     ThreadRootCreator * threads;
+
+    bool queued;
+    bool solo;
 };
 
 
+class InjectorGroup
+    : public EventHandler
+{
+public:
+    InjectorGroup(): EventHandler(), leader( 0 ) {}
+
+    List<Injector> members;
+    Injector * leader;
+
+    void start();
+    void execute();
+};
+
+
+class InjectorQueue
+    : public Garbage
+{
+public:
+    InjectorQueue(): Garbage(), running( 0 ) {}
+
+    List<Injector> waiting;
+    InjectorGroup * running;
+};
+
+
+static InjectorQueue * queue;
+
+
+/*! \class InjectorGroup injector.cpp
+
+    The InjectorGroup class stores the messages of several Injector
+    objects using a single transaction (group commit).
+
+    When an Injector which just stores messages starts, it joins the
+    queue of waiting injectors. If no group is running, a group is
+    formed at once. While a group runs, further injectors wait, and
+    when it finishes, up to injection-group-size of them are formed
+    into the next group. Under light load each group has one member,
+    and under heavy load each transaction stores many messages and
+    locks each mailbox only once.
+
+    If a group with several members fails, each member is retried on
+    its own, so that one bad message doesn't cause its neighbours to
+    be rejected.
+*/
+
+
+/*! Forms a group from the waiting injectors and starts injecting
+    their messages.
+*/
+
+void InjectorGroup::start()
+{
+    uint max = Configuration::scalar( Configuration::InjectionGroupSize );
+    while ( !::queue->waiting.isEmpty() && members.count() < max )
+        members.append( ::queue->waiting.shift() );
+
+    ::queue->running = this;
+    leader = new Injector( this );
+    List<Injector>::Iterator i( members );
+    while ( i ) {
+        i->findMessages();
+        leader->addInjection( &i->d->messages );
+        ++i;
+    }
+    if ( members.count() > 1 )
+        leader->log( "Injecting messages for " + fn( members.count() ) +
+                     " injectors using one transaction" );
+    leader->execute();
+}
+
+
+/*! Reports the result of the group's injection to its members, and
+    starts the next group.
+*/
+
+void InjectorGroup::execute()
+{
+    if ( !leader->done() )
+        return;
+
+    List<Injector>::Iterator i( members );
+    while ( i ) {
+        Injector * m = i;
+        ++i;
+        if ( !leader->failed() ) {
+            m->d->state = Done;
+            m->execute();
+        }
+        else if ( members.count() > 1 ) {
+            m->d->queued = false;
+            m->d->solo = true;
+            m->d->messages.clear();
+            m->execute();
+        }
+        else {
+            m->d->transaction = leader->d->transaction;
+            m->d->failed = true;
+            m->d->state = Done;
+            m->execute();
+        }
+    }
+
+    ::queue->running = 0;
+    if ( !::queue->waiting.isEmpty() )
+        (new InjectorGroup)->start();
+}
+
+
 /*! \class Injector injector.h
     Stores message objects in the database.
 
@@ -320,6 +437,23 @@ void Injector::execute()
 {
     Scope x( log() );
 
+    if ( d->queued && d->state != Done )
+        return;
+
+    if ( d->state == Inactive && !d->queued && groupable() ) {
+        if ( !::queue ) {
+            ::queue = new InjectorQueue;
+            Allocator::addEternal( ::queue, "injector queue" );
+        }
+        d->queued = true;
+        ::queue->waiting.append( this );
+        if ( ::queue->running )
+            log( "Waiting for another injection to finish", Log::Debug );
+        else
+            (new InjectorGroup)->start();
+        return;
+    }
+
     State last;
 
     // We start in state Inactive, and execute the functions responsible
@@ -339,8 +473,10 @@ void Injector::execute()
                 d->state = Done;
             }
             else {
-                if ( !d->transaction )
+                if ( !d->transaction ) {
                     d->transaction = new Transaction( this );
+                    d->transaction->setPriority( Query::Delivery );
+                }
                 next();
             }
             break;
@@ -404,10 +540,24 @@ void Injector::execute()
 
             if ( d->failed || d->transaction->failed() ) {
                 ::failures->tick();
+                AddressCache::forget();
                 Cache::clearAllCaches( false );
             }
             else {
-                ::successes->tick();
+                // a group injects several injectors' messages
+                ::successes->setValue( ::successes->lastValue() +
+                                       d->messages.count() );
+                // the new addresses exist now that we've committed,
+                // unless we only released a savepoint in someone
+                // else's transaction
+                if ( d->addressCreator && !d->transaction->parent() ) {
+                    List<Address> * l = d->addressCreator->created();
+                    List<Address>::Iterator a( l );
+                    while ( a ) {
+                        AddressCache::insert( a );
+                        ++a;
+                    }
+                }
             }
 
             next();
@@ -439,6 +589,29 @@ void Injector::execute()
 }
 
 
+/*! Returns true if this Injector may let an InjectorGroup store its
+    messages, ie. if it only stores valid messages in mailboxes and no
+    other work depends on its transaction.
+*/
+
+bool Injector::groupable() const
+{
+    if ( d->solo || d->transaction ||
+         !d->deliveries.isEmpty() || !d->addresses.isEmpty() ||
+         d->injectables.isEmpty() )
+        return false;
+    if ( Configuration::scalar( Configuration::InjectionGroupSize ) < 2 )
+        return false;
+    List<Injectee>::Iterator i( d->injectables );
+    while ( i ) {
+        if ( !i->valid() )
+            return false;
+        ++i;
+    }
+    return true;
+}
+
+
 /*! This private helper makes a master list of messages to be
     inserted, based on what addDelivery() and addInjection() have
     done.
@@ -465,9 +638,10 @@ void Injector::findMessages()
         }
         ++dm;
     }
-    log( "Injecting " + fn( d->messages.count() ) + " messages (" +
-         fn( d->injectables.count() ) + ", " +
-         fn( d->deliveries.count() ) + ")", Log::Debug );
+    if ( Log::enabled( Log::Debug ) )
+        log( "Injecting " + fn( d->messages.count() ) + " messages (" +
+             fn( d->injectables.count() ) + ", " +
+             fn( d->deliveries.count() ) + ")", Log::Debug );
 }
 
 
@@ -698,9 +872,9 @@ void Injector::createDependencies()
     }
 
     if ( !d->addresses.isEmpty() ) {
-        AddressCreator * ac
+        d->addressCreator
             = new AddressCreator( &d->addresses, d->transaction );
-        ac->execute();
+        d->addressCreator->execute();
     }
 
     next();
@@ -993,7 +1167,9 @@ void Injector::convertThreadIndex()
             // this will be run first because of "order by field desc" above
             t = new InjectorData::ThreadParentInfo;
             antecedents.insert( r->getEString( "value" ), t );
-            log( "antecedent <" + r->getEString( "value" ) + ">", Log::Debug );
+            if ( Log::enabled( Log::Debug ) )
+                log( "antecedent <" + r->getEString( "value" ) + ">",
+                     Log::Debug );
             antecedents2.insert( m, t );
         }
     }
@@ -1024,7 +1200,8 @@ void Injector::convertThreadIndex()
             if ( !tpi && t.length() > 27 ) {
                 // we don't, but maybe there is a grandparent?
                 EString gt = t.mid( 0, ( (t.length() - 22 - 6) / 5 ) * 5 + 22 );
-                log( "considering <" + gt.e64() + ">", Log::Debug );
+                if ( Log::enabled( Log::Debug ) )
+                    log( "considering <" + gt.e64() + ">", Log::Debug );
                 tpi = antecedents.find( gt.e64() );
             }
             if ( tpi && ref.isEmpty() ) {
@@ -1584,7 +1761,9 @@ void Injector::insertMessages()
             EString pnr( "raw-pgp-signed" );
             bp = m->children()->shift(); // avoid starting pns with 2
             addPartNumber( qp, mid, pnr, bp );
-            ::log( "Injector::insertMessages - added partnumber for raw-signed part: " + pnr, Log::Debug );
+            if ( Log::enabled( Log::Debug ) )
+                ::log( "Injector::insertMessages - added partnumber "
+                       "for raw-signed part: " + pnr, Log::Debug );
         }
         List<Bodypart>::Iterator bi( m->allBodyparts() );
         while ( bi ) {
@@ -68,7 +68,9 @@ public:
 
 private:
     class InjectorData * d;
+    friend class InjectorGroup;
 
+    bool groupable() const;
     void next();
     void createMailboxes();
     void findMessages();
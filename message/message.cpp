@@ -15,6 +15,7 @@
 #include "dict.h"
 #include "flag.h"
 #include "md5.h"
+#include "rfc822cache.h"
 
 
 static const char * crlf = "\015\012";
@@ -292,10 +293,18 @@ EString Message::error() const
 
     If \a avoidUtf8 is true, this function loses information rather
     than including UTF-8 in the result.
+
+    If the message has been stored in the database and is completely
+    known, the result is kept in the Rfc822Cache, and the size is
+    recorded for rfc822Size() if that wasn't already known.
 */
 
 EString Message::rfc822( bool avoidUtf8 ) const
 {
+    EString * cached = Rfc822Cache::find( d->databaseId, avoidUtf8 );
+    if ( cached )
+        return *cached;
+
     EString r;
     if ( d->rfc822Size )
         r.reserve( d->rfc822Size );
@@ -306,6 +315,13 @@ EString Message::rfc822( bool avoidUtf8 ) const
     r.append( crlf );
     r.append( body( avoidUtf8 ) );
 
+    if ( d->databaseId &&
+         d->hasHeaders && d->hasAddresses && d->hasBodies ) {
+        if ( !avoidUtf8 && !d->rfc822Size )
+            d->rfc822Size = r.length();
+        Rfc822Cache::insert( d->databaseId, avoidUtf8, r );
+    }
+
     return r;
 }
 
@@ -0,0 +1,149 @@
+// Copyright 2009 The Archiveopteryx Developers <info@aox.org>
+
+#include "rfc822cache.h"
+
+#include "configuration.h"
+#include "estring.h"
+#include "server.h"
+#include "list.h"
+#include "map.h"
+
+
+static class Rfc822Cache * c = 0;
+
+
+class Rfc822CacheEntry
+    : public Garbage
+{
+public:
+    Rfc822CacheEntry( uint i, bool a )
+        : Garbage(), id( i ), avoidUtf8( a ) {}
+    uint id;
+    bool avoidUtf8;
+};
+
+
+class Rfc822CacheData
+    : public Garbage
+{
+public:
+    Rfc822CacheData(): Garbage(), size( 0 ) {}
+    Map<EString> unicode;
+    Map<EString> ascii;
+    List<Rfc822CacheEntry> order;
+    uint size;
+
+    Map<EString> & map( bool avoidUtf8 ) {
+        if ( avoidUtf8 )
+            return ascii;
+        return unicode;
+    }
+};
+
+
+/*! \class Rfc822Cache rfc822cache.h
+
+    The Rfc822Cache class keeps the text produced by Message::rfc822()
+    for messages that have been stored in the database, so that
+    repeated FETCH BODY[] and POP RETR commands for the same message
+    don't have to reassemble it from its Header and Bodypart objects.
+
+    Messages in the database never change, so the text is keyed only
+    by Message::databaseId() and the avoidUtf8 argument to rfc822().
+
+    The cache is bounded by the rfc822-cache-size configuration
+    variable (in megabytes). If that is 0, nothing is cached. When the
+    cache is full, the oldest entries are discarded first.
+*/
+
+
+/*! Constructs an empty Rfc822Cache. Should not be called directly,
+    only via insert().
+*/
+
+Rfc822Cache::Rfc822Cache()
+    : Cache( 10 ), d( new Rfc822CacheData )
+{
+    // nothing
+}
+
+
+/*! Returns true if the cache may be used, and false if it's disabled
+    by configuration (or because the Server doesn't use caches).
+*/
+
+bool Rfc822Cache::enabled()
+{
+    return Server::useCache() &&
+        Configuration::scalar( Configuration::Rfc822CacheSize ) > 0;
+}
+
+
+/*! Records that the rendered text of the message with database ID \a
+    id is \a text, when Message::rfc822() is called with \a avoidUtf8.
+    Does nothing if the cache is disabled or \a text alone would use
+    more than a quarter of it.
+*/
+
+void Rfc822Cache::insert( uint id, bool avoidUtf8, const EString & text )
+{
+    if ( !id || !enabled() )
+        return;
+
+    uint limit = 1024 * 1024 *
+                 Configuration::scalar( Configuration::Rfc822CacheSize );
+    if ( text.length() > limit / 4 )
+        return;
+
+    if ( !c )
+        c = new Rfc822Cache;
+
+    Map<EString> & m = c->d->map( avoidUtf8 );
+    if ( m.find( id ) )
+        return;
+
+    c->shrink( limit - text.length() );
+    m.insert( id, new EString( text ) );
+    c->d->order.append( new Rfc822CacheEntry( id, avoidUtf8 ) );
+    c->d->size += text.length();
+}
+
+
+/*! Returns a pointer to the cached text of the message with database
+    ID \a id, as rendered with \a avoidUtf8, or a null pointer if
+    that's not in the cache.
+*/
+
+EString * Rfc822Cache::find( uint id, bool avoidUtf8 )
+{
+    if ( !c || !id )
+        return 0;
+    return c->d->map( avoidUtf8 ).find( id );
+}
+
+
+/*! Discards the oldest entries until the cache uses at most \a size
+    bytes.
+*/
+
+void Rfc822Cache::shrink( uint size )
+{
+    while ( d->size > size && !d->order.isEmpty() ) {
+        Rfc822CacheEntry * e = d->order.shift();
+        Map<EString> & m = d->map( e->avoidUtf8 );
+        EString * s = m.find( e->id );
+        if ( s ) {
+            d->size -= s->length();
+            m.remove( e->id );
+        }
+    }
+}
+
+
+void Rfc822Cache::clear()
+{
+    d->unicode.clear();
+    d->ascii.clear();
+    d->order.clear();
+    d->size = 0;
+}
@@ -0,0 +1,33 @@
+// Copyright 2009 The Archiveopteryx Developers <info@aox.org>
+
+#ifndef RFC822CACHE_H
+#define RFC822CACHE_H
+
+#include "cache.h"
+
+class EString;
+
+
+class Rfc822Cache
+    : public Cache
+{
+private:
+    Rfc822Cache();
+
+public:
+    static void insert( uint, bool, const EString & );
+    static EString * find( uint, bool );
+
+    static bool enabled();
+
+    void clear();
+
+private:
+    void shrink( uint );
+
+private:
+    class Rfc822CacheData * d;
+};
+
+
+#endif
@@ -28,7 +28,8 @@ public:
           wbt( 0 ), wbs( 0 ),
           enhancedstatuscodes( false ),
           unicode( false ),
-          size( false )
+          size( false ), pipelining( false ), chunking( false ),
+          unanswered( 0 ), skip( 0 )
     {}
 
     enum State { Invalid,
@@ -40,7 +41,7 @@ public:
     EString sent;
     EString error;
     DSN * dsn;
-    EString dotted;
+    EString body;
     EventHandler * owner;
     Log * log;
     bool sentMail;
@@ -52,6 +53,10 @@ public:
     bool enhancedstatuscodes;
     bool unicode;
     bool size;
+    bool pipelining;
+    bool chunking;
+    uint unanswered;
+    uint skip;
     Timer * closeTimer;
     class TimerCloser
         : public EventHandler
@@ -192,7 +197,16 @@ void SmtpClient::parse()
                 recordExtension( *s );
             }
         }
+        else if ( (*s)[3] == ' ' && d->skip ) {
+            // a reply to a pipelined command after MAIL FROM failed
+            d->unanswered--;
+            d->skip--;
+            if ( !d->skip )
+                sendCommand();
+        }
         else if ( (*s)[3] == ' ' ) {
+            if ( d->unanswered )
+                d->unanswered--;
             switch ( response/100 ) {
             case 1:
                 d->error = "Server sent 1xx response: " + *s;
@@ -210,11 +224,15 @@ void SmtpClient::parse()
             case 3:
                 if ( d->state == SmtpClientData::Data ) {
                     log( "Sending body.", Log::Debug );
-                    if ( d->dotted.isEmpty() )
-                        d->dotted =
-                            dotted( d->dsn->message()->rfc822( !d->unicode ) );
-                    enqueue( d->dotted );
-                    d->dotted.truncate();
+                    if ( d->accepted.isEmpty() )
+                        // DATA was pipelined, but no recipient was accepted
+                        enqueue( ".\r\n" );
+                    else if ( d->body.isEmpty() )
+                        enqueue( dotted( d->dsn->message()->rfc822(
+                                             !d->unicode ) ) );
+                    else
+                        enqueue( d->body );
+                    d->body.truncate();
                     d->wbs = writeBuffer()->size();
                     d->wbt = (uint)::time( 0 );
                     d->state = SmtpClientData::Body;
@@ -253,6 +271,7 @@ void SmtpClient::parse()
 void SmtpClient::sendCommand()
 {
     EString send;
+    bool withBody = false;
 
     switch( d->state ) {
     case SmtpClientData::Invalid:
@@ -277,20 +296,43 @@ void SmtpClient::sendCommand()
         if ( d->dsn->sender()->type() == Address::Normal )
             send.append( d->dsn->sender()->lpdomain() );
         send.append( ">" );
-        if ( d->dsn->message()->needsUnicode() ) {
+        if ( d->dsn->message()->needsUnicode() )
             send.append( " smtputf8" );
-            if ( d->dotted.isEmpty() )
-                d->dotted = dotted( d->dsn->message()->rfc822( false ) );
-        }
-        else if ( d->dotted.isEmpty() ) {
-            d->dotted = dotted( d->dsn->message()->rfc822( true ) );
+        if ( d->body.isEmpty() ) {
+            EString text = d->dsn->message()->rfc822(
+                !d->dsn->message()->needsUnicode() );
+            if ( d->chunking )
+                d->body = text.crlf();
+            else
+                d->body = dotted( text );
         }
         if ( d->size ) {
             send.append( " size=" );
-            send.append( fn( d->dotted.length() ) );
+            send.append( fn( d->body.length() ) );
         }
 
         d->state = SmtpClientData::MailFrom;
+
+        if ( d->pipelining ) {
+            // RFC 2920: send all RCPT TO commands (and DATA) along
+            // with MAIL FROM. The replies are processed one by one
+            // just as if we had waited for each, and sendCommand()
+            // doesn't repeat a command that's already been sent.
+            d->unanswered = 1;
+            List<Recipient>::Iterator i( d->dsn->recipients() );
+            while ( i ) {
+                if ( i->action() == Recipient::Unknown ) {
+                    send.append( "\r\nrcpt to:<" +
+                                 i->finalRecipient()->lpdomain() + ">" );
+                    d->unanswered++;
+                }
+                ++i;
+            }
+            if ( !d->chunking ) {
+                send.append( "\r\ndata" );
+                d->unanswered++;
+            }
+        }
         break;
 
     case SmtpClientData::MailFrom:
@@ -308,10 +350,21 @@ void SmtpClient::sendCommand()
             send = "rcpt to:<" + d->rcptTo->finalRecipient()->lpdomain() + ">";
         }
         else {
-            if ( !d->accepted.isEmpty() ) {
+            if ( !d->accepted.isEmpty() && d->chunking ) {
+                // RFC 3030: the whole body as one chunk, no dot-stuffing
+                send = "bdat " + fn( d->body.length() ) + " last";
+                withBody = true;
+                d->state = SmtpClientData::Body;
+            }
+            else if ( !d->accepted.isEmpty() ) {
                 send = "data";
                 d->state = SmtpClientData::Data;
             }
+            else if ( d->unanswered ) {
+                // DATA has been pipelined already; we have to send
+                // an empty body once the server answers it
+                d->state = SmtpClientData::Data;
+            }
             else {
                 finish( "4.5.0" );
                 send = "rset";
@@ -341,7 +394,9 @@ void SmtpClient::sendCommand()
     case SmtpClientData::Rset:
         finish( "4.5.0" );
         delete d->closeTimer;
-        if ( idleClient() == this )
+        // keep as many idle connections as the SpoolManager may use
+        if ( idleClients() <=
+             Configuration::scalar( Configuration::SmartHostConnections ) )
             d->closeTimer = new Timer( d->timerCloser, 298 );
         else
             d->closeTimer = new Timer( d->timerCloser, 15 );
@@ -361,9 +416,21 @@ void SmtpClient::sendCommand()
     if ( send.isEmpty() )
         return;
 
+    if ( d->unanswered && d->state != SmtpClientData::MailFrom ) {
+        // part of the pipelined batch, which has already been sent
+        d->sent = send;
+        return;
+    }
+
     log( "Sending: " + send, Log::Debug );
     enqueue( send + "\r\n" );
     d->sent = send;
+    if ( withBody ) {
+        enqueue( d->body );
+        d->body.truncate();
+        d->wbs = writeBuffer()->size();
+        d->wbt = (uint)::time( 0 );
+    }
     setTimeoutAfter( 300 );
 }
 
@@ -533,6 +600,11 @@ void SmtpClient::handleFailure( const EString & line )
             ++i;
         }
         d->state = SmtpClientData::Error;
+        if ( d->unanswered ) {
+            // wait for the replies to the rest of the pipelined batch
+            d->skip = d->unanswered;
+            return;
+        }
     }
     sendCommand();
 }
@@ -585,7 +657,10 @@ void SmtpClient::send( DSN * dsn, EventHandler * user )
     log( s, Log::Significant );
 
     d->dsn = dsn;
-    d->dotted.truncate();
+    d->body.truncate();
+    d->unanswered = 0;
+    d->skip = 0;
+    d->accepted.clear();
     d->owner = user;
     d->sentMail = false;
     delete d->closeTimer;
@@ -615,7 +690,7 @@ void SmtpClient::finish( const char * status )
     if ( d->owner )
         d->owner->notify();
     d->dsn = 0;
-    d->dotted.truncate();
+    d->body.truncate();
     d->owner = 0;
     d->log = 0;
 }
@@ -644,6 +719,12 @@ void SmtpClient::recordExtension( const EString & line )
         d->size = true;
         ::observedSize = l.section( " ", 2 ).number( 0 );
     }
+    else if ( w == "pipelining" ) {
+        d->pipelining = true;
+    }
+    else if ( w == "chunking" ) {
+        d->chunking = true;
+    }
 }
 
 
@@ -740,6 +821,25 @@ SmtpClient * SmtpClient::idleClient()
 }
 
 
+/*! This private helper returns the number of idle SMTP clients. */
+
+uint SmtpClient::idleClients()
+{
+    uint n = 0;
+    List<Connection>::Iterator c( EventLoop::global()->connections() );
+    while ( c ) {
+        if ( c->type() == Connection::SmtpClient ) {
+            Connection * tmp = c;
+            SmtpClient * sc = (SmtpClient*)tmp;
+            if ( sc->d->state == SmtpClientData::Rset )
+                n++;
+        }
+        ++c;
+    }
+    return n;
+}
+
+
 /*! Returns the SIZE argument provided by the smarthost, or something smaller
     if the smarthost's capacity outstrips our own.
 */
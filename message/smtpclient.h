@@ -47,6 +47,7 @@ private:
     static EString dotted( const EString & );
 
     static SmtpClient * idleClient();
+    static uint idleClients();
 };
 
 
@@ -392,6 +392,7 @@ void SaslMechanism::verify()
     else if ( d->ldapRelay ) {
         switch ( d->ldapRelay->state() ) {
         case LdapRelay::BindSucceeded:
+            d->user->setVerified( secret() );
             setState( Succeeded );
             break;
         case LdapRelay::BindFailed:
@@ -402,7 +403,10 @@ void SaslMechanism::verify()
         }
     }
     else if ( d->user && !d->user->ldapdn().isEmpty() ) {
-        d->ldapRelay = new LdapRelay( this );
+        if ( d->user->verified( secret() ) )
+            setState( Succeeded );
+        else
+            d->ldapRelay = new LdapRelay( this );
     }
     else if ( storedSecret().isEmpty() || storedSecret() == secret() ) {
         setState( Succeeded );
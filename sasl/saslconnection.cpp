@@ -2,16 +2,160 @@
 
 #include "saslconnection.h"
 
+#include "log.h"
+#include "utf.h"
+#include "date.h"
 #include "user.h"
 #include "query.h"
+#include "timer.h"
 #include "estring.h"
 #include "endpoint.h"
 #include "eventloop.h"
+#include "estringlist.h"
 
 // time
 #include <time.h>
 
 
+// rows are written at least this often (in seconds)...
+static const uint flushInterval = 5;
+// ...or as soon as there are this many
+static const uint flushSize = 128;
+// and if the database can't keep up, we keep at most this many
+static const uint maxRows = 8192;
+
+
+class ConnectionRecorder
+    : public EventHandler
+{
+public:
+    ConnectionRecorder()
+        : EventHandler(), q( 0 ), timer( 0 ), dropped( 0 ) {}
+
+    void record( EStringList * );
+    void flush();
+    void execute();
+
+    List<EStringList> rows;
+    Query * q;
+    Timer * timer;
+    uint dropped;
+};
+
+
+static ConnectionRecorder * recorder = 0;
+
+
+/*! Returns \a s quoted for use as a field in a text-format COPY. */
+
+static EString copyField( const EString & s )
+{
+    EString r;
+    r.reserve( s.length() );
+    uint i = 0;
+    while ( i < s.length() ) {
+        char c = s[i];
+        if ( c == '\\' )
+            r.append( "\\\\" );
+        else if ( c == '\t' )
+            r.append( "\\t" );
+        else if ( c == '\n' )
+            r.append( "\\n" );
+        else if ( c == '\r' )
+            r.append( "\\r" );
+        else
+            r.append( c );
+        i++;
+    }
+    return r;
+}
+
+
+/*! Returns \a t (a unix time) as a timestamptz for COPY. */
+
+static EString copyTime( uint t )
+{
+    Date d;
+    d.setUnixTime( t );
+    return d.isoDateTime();
+}
+
+
+/*! Queues the connections \a row for writing, and writes the queued
+    rows at once if there are enough of them, or if the server is
+    shutting down.
+*/
+
+void ConnectionRecorder::record( EStringList * row )
+{
+    if ( rows.count() >= maxRows ) {
+        rows.shift();
+        dropped++;
+    }
+    rows.append( row );
+
+    if ( rows.count() >= flushSize || EventLoop::global()->inShutdown() )
+        flush();
+    else if ( !timer )
+        timer = new Timer( this, flushInterval );
+}
+
+
+/*! Writes all queued rows using a single COPY, unless a COPY is
+    already running, in which case the rows wait until it's done.
+*/
+
+void ConnectionRecorder::flush()
+{
+    if ( q && !q->done() )
+        return;
+
+    if ( dropped ) {
+        ::log( "Could not record " + fn( dropped ) +
+               " connections, since the database was too slow",
+               Log::Error );
+        dropped = 0;
+    }
+
+    q = 0;
+    if ( rows.isEmpty() )
+        return;
+
+    q = new Query( "copy connections "
+                   "(username,address,port,mechanism,authfailures,"
+                   "syntaxerrors,started_at,ended_at,userid) "
+                   "from stdin", this );
+    q->allowFailure();
+    while ( !rows.isEmpty() ) {
+        EStringList::Iterator f( rows.shift() );
+        uint n = 1;
+        while ( f ) {
+            q->bind( n, *f );
+            ++f;
+            ++n;
+        }
+        q->submitLine();
+    }
+    q->execute();
+}
+
+
+void ConnectionRecorder::execute()
+{
+    if ( timer && !timer->active() )
+        timer = 0;
+
+    if ( q && !q->done() )
+        return;
+    if ( q && q->failed() )
+        ::log( "Could not record connections: " + q->error(), Log::Error );
+
+    flush();
+    if ( !rows.isEmpty() && !timer )
+        timer = new Timer( this, flushInterval );
+}
+
+
 /*! \class SaslConnection saslconnection.h
     A connection that can engage in a SASL negotiation.
 */
@@ -66,6 +210,10 @@ void SaslConnection::setUser( User * user, const EString & mechanism )
 /*! This reimplementation logs the connection in the connections table
     and cancels any other queries still running.
 
+    The connections rows are not written one by one. They are queued
+    and written in batches using COPY every few seconds, so that
+    connection churn doesn't cost one insert per connection.
+
     If the connection is closed as part of server shutdown, then it's
     probably too late to execute a new Query. We're tolerant of that.
 */
@@ -81,26 +229,23 @@ void SaslConnection::close()
 
     logged = true;
 
-    Query * q = new Query(
-        "insert into connections "
-        "(username,address,port,mechanism,authfailures,"
-        "syntaxerrors,started_at,ended_at,userid) "
-        "values ($1,$2,$3,$4,$5,$6,"
-        "$7::interval + 'epoch'::timestamptz,"
-        "$8::interval + 'epoch'::timestamptz,$9)", 0
-    );
-
-    q->bind( 1, u->login() );
-    q->bind( 2, client.address() );
-    q->bind( 3, client.port() );
-    q->bind( 4, m );
-    q->bind( 5, af );
-    q->bind( 6, sf );
-    q->bind( 7, s );
-    q->bind( 8, (uint)time( 0 ) );
-    q->bind( 9, u->id() );
-    q->execute();
-
+    PgUtf8Codec p;
+    EStringList * row = new EStringList;
+    row->append( copyField( p.fromUnicode( u->login() ) ) );
+    row->append( copyField( client.address() ) );
+    row->append( fn( client.port() ) );
+    row->append( copyField( m ) );
+    row->append( fn( af ) );
+    row->append( fn( sf ) );
+    row->append( copyTime( s ) );
+    row->append( copyTime( (uint)time( 0 ) ) );
+    row->append( fn( u->id() ) );
+
+    if ( !::recorder ) {
+        ::recorder = new ConnectionRecorder;
+        Allocator::addEternal( ::recorder, "connection recorder" );
+    }
+    ::recorder->record( row );
 }
 
 
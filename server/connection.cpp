@@ -30,6 +30,12 @@
 #include <time.h>
 
 
+// writeBufferFull() returns true above this many buffered bytes, and
+// writeBufferDrained() is called once we're below the lower mark.
+static const uint highWaterMark = 262144;
+static const uint lowWaterMark = 65536;
+
+
 class ConnectionData
     : public Garbage
 {
@@ -38,10 +44,10 @@ public:
         : r( 0 ), w( 0 ),
           tls( 0 ), l( 0 ), session( 0 ),
           fd( -1 ), timeout( 0 ),
-          wbt( 0 ), wbs( 0 ),
+          wbt( 0 ), wbs( 0 ), wbPeak( 0 ),
           state( Connection::Invalid ),
           type( Connection::Client ),
-          pending( false )
+          pending( false ), throttled( false )
     {}
 
     Buffer *r, *w;
@@ -50,11 +56,12 @@ public:
     Session * session;
     int fd;
     uint timeout;
-    uint wbt, wbs;
+    uint wbt, wbs, wbPeak;
     Connection::State state;
 
     Connection::Type type;
     bool pending;
+    bool throttled;
     Endpoint self, peer;
     Connection::Event event;
 };
@@ -518,6 +525,9 @@ Endpoint Connection::peer() const
 
 void Connection::close()
 {
+    if ( valid() && d->wbPeak > highWaterMark )
+        log( "Write buffer peaked at " +
+             EString::humanNumber( d->wbPeak ) + " bytes", Log::Debug );
     if ( valid() && d->fd >= 0 )
         ::close( d->fd );
     if ( d->tls )
@@ -548,6 +558,8 @@ void Connection::write()
     if ( !valid() )
         return;
 
+    if ( d->w->size() > d->wbPeak )
+        d->wbPeak = d->w->size();
     d->w->write( d->fd );
     uint wbs = d->w->size();
     if ( wbs && !d->wbs ) {
@@ -568,6 +580,11 @@ void Connection::write()
         d->wbt = 0;
         d->wbs = 0;
     }
+
+    if ( d->throttled && wbs < lowWaterMark && d->state == Connected ) {
+        d->throttled = false;
+        writeBufferDrained();
+    }
 }
 
 
@@ -597,6 +614,44 @@ void Connection::enqueue( const EString &s )
 }
 
 
+/*! Returns true if the writeBuffer() holds so much data that the
+    caller should stop producing output for the moment, and false if
+    it's fine to enqueue() more.
+
+    If this function returns true, writeBufferDrained() is called once
+    the peer has read enough that the writeBuffer() is nearly empty.
+*/
+
+bool Connection::writeBufferFull()
+{
+    if ( d->w->size() < highWaterMark )
+        return false;
+    d->throttled = true;
+    return true;
+}
+
+
+/*! This virtual function is called by write() when the writeBuffer()
+    has become nearly empty after writeBufferFull() returned true.
+    Subclasses which throttle their output should reimplement it to
+    resume producing output. The default implementation does nothing.
+*/
+
+void Connection::writeBufferDrained()
+{
+}
+
+
+/*! Returns the largest number of bytes the writeBuffer() has held at
+    any time.
+*/
+
+uint Connection::writeBufferPeak() const
+{
+    return d->wbPeak;
+}
+
+
 /*! \fn void Connection::react( Event event )
 
     Subclasses are required to define this method to react appropriately
@@ -70,7 +70,11 @@ public:
     virtual void write();
     virtual bool canWrite();
 
-    void enqueue( const EString & );
+    virtual void enqueue( const EString & );
+
+    bool writeBufferFull();
+    virtual void writeBufferDrained();
+    uint writeBufferPeak() const;
 
     enum Event { Error, Connect, Read, Timeout, Close, Shutdown };
     virtual void react( Event ) = 0;
@@ -3,6 +3,7 @@
 #include "event.h"
 
 #include "scope.h"
+#include "eventloop.h"
 
 
 /*! \class EventHandler event.h
@@ -83,5 +84,6 @@ void EventHandler::log( const EString &m, Log::Severity s ) const
 void EventHandler::notify()
 {
     Scope x( log() );
+    CallbackTimer t( this );
     execute();
 }
@@ -2,6 +2,7 @@
 
 #include "eventloop.h"
 
+#include "configuration.h"
 #include "connection.h"
 #include "allocator.h"
 #include "buffer.h"
@@ -31,11 +32,33 @@
 
 // memset (for FD_* under OpenBSD)
 #include <string.h>
+// typeid
+#include <typeinfo>
+// abi::__cxa_demangle
+#include <cxxabi.h>
+// free
+#include <stdlib.h>
 
 
 static bool freeMemorySoon;
 
 
+// how long (in microseconds) a round of the loop may spend on
+// deferred work once it has done some
+static const uint deferredBudget = 10000;
+
+
+/* Returns the current time in microseconds. */
+
+static int64 timeInMicroseconds()
+{
+    struct timeval tv;
+    if ( ::gettimeofday( &tv, 0 ) < 0 )
+        return 0;
+    return (int64)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+
 static EventLoop * loop;
 
 
@@ -53,6 +76,7 @@ public:
     bool stop;
     List< Connection > connections;
     List< Timer > timers;
+    List< EventHandler > deferred;
     uint limit;
 
     class Stopper
@@ -186,6 +210,7 @@ List< Connection > *EventLoop::connections() const
 
 
 static GraphableNumber * sizeinram = 0;
+static GraphableHistogram * loopLag = 0;
 
 static const uint gcDelay = 30;
 
@@ -265,8 +290,12 @@ void EventLoop::start()
         if ( tv.tv_sec > 60 )
             tv.tv_sec = 60;
 
-        // we never ask the OS to sleep shorter than .2 seconds
-        if ( tv.tv_sec < 1 )
+        // we never ask the OS to sleep shorter than .2 seconds,
+        // unless there's deferred work waiting, in which case we
+        // only poll.
+        if ( !d->deferred.isEmpty() )
+            tv.tv_sec = 0;
+        else if ( tv.tv_sec < 1 )
             tv.tv_usec = 200000;
 
         if ( select( maxfd+1, &r, &w, 0, &tv ) < 0 ) {
@@ -276,6 +305,7 @@ void EventLoop::start()
             FD_ZERO( &w );
         }
         time_t now = time( 0 );
+        int64 roundStarted = timeInMicroseconds();
 
         // Graph our size before processing events
         if ( !sizeinram )
@@ -312,6 +342,17 @@ void EventLoop::start()
             }
         }
 
+        // Do some of the deferred work, but not so much that the
+        // connections have to wait long for the next round.
+
+        if ( !d->deferred.isEmpty() ) {
+            int64 started = timeInMicroseconds();
+            do {
+                runDeferred( d->deferred.shift() );
+            } while ( !d->deferred.isEmpty() &&
+                      timeInMicroseconds() < started + deferredBudget );
+        }
+
         // Graph our size after processing all the events too
 
         sizeinram->setValue( Allocator::inUse() + Allocator::allocated() );
@@ -349,6 +390,12 @@ void EventLoop::start()
                 ::freeMemorySoon = false;
             }
         }
+
+        // Graph how long this round kept ready connections waiting
+
+        if ( !loopLag )
+            loopLag = new GraphableHistogram( "event-loop-lag" );
+        loopLag->addNumber( timeInMicroseconds() - roundStarted );
     }
 
     // This is for event loop shutdown. A little brutal. With any
@@ -433,6 +480,7 @@ void EventLoop::dispatch( Connection * c, bool r, bool w, uint now )
 
     try {
         Scope x( c->log() );
+        CallbackTimer ct( c );
         if ( c->timeout() != 0 && now >= c->timeout() ) {
             c->setTimeout( 0 );
             c->react( Connection::Timeout );
@@ -681,6 +729,50 @@ void EventLoop::removeTimer( Timer * t )
         d->timers.take( i );
 }
 
+
+/*! Arranges for \a h to be executed once, after the event loop has
+    dispatched the events of the current round.
+
+    CPU-heavy work, such as parsing a large message, should be
+    deferred using this function. The event loop does only a limited
+    amount of deferred work per round and serves the connections in
+    between, so that one big job doesn't stall everyone else.
+*/
+
+void EventLoop::defer( EventHandler * h )
+{
+    if ( h && !d->deferred.find( h ) )
+        d->deferred.append( h );
+}
+
+
+/*! Executes the deferred EventHandler \a h. If it throws an
+    exception, we close the connection (if any) on whose behalf \a h
+    was working, much as dispatch() would.
+*/
+
+void EventLoop::runDeferred( EventHandler * h )
+{
+    try {
+        h->notify();
+    }
+    catch ( const Exception& e ) {
+        Log * l = h->log();
+        List<Connection>::Iterator i( d->connections );
+        while ( i ) {
+            Connection * c = i;
+            ++i;
+            if ( c->type() != Connection::Listener &&
+                 l && l->isChildOf( c->log() ) ) {
+                d->log->log( "Exception while processing " +
+                             c->description(), Log::Error );
+                c->close();
+                removeConnection( c );
+            }
+        }
+    }
+}
+
 static GraphableNumber * imapgraph = 0;
 static GraphableNumber * pop3graph = 0;
 static GraphableNumber * smtpgraph = 0;
@@ -813,3 +905,148 @@ uint EventLoop::memoryUsage() const
 {
     return d->limit;
 }
+
+
+static uint slowCallbackThreshold = 0;
+static uint callbackSampleInterval = 0;
+static uint callbacks = 0;
+static bool callbackTimingSetUp = false;
+static GraphableHistogram * callbackTimes = 0;
+static uint callbackTypes = 0;
+static const uint maxCallbackTypes = 64;
+static CallbackTimer * innermostCallback = 0;
+
+
+/*! \class CallbackTimer eventloop.h
+
+    The CallbackTimer class measures how long a single callback (such
+    as EventLoop::dispatch() or an EventHandler::execute()) keeps the
+    event loop busy. It's meant to be used on the stack, like Scope:
+    The constructor starts the clock and the destructor stops it.
+
+    If the callback takes longer than slow-callback-threshold, the
+    destructor logs it along with the name of the handler's class. One
+    in every callback-sample-interval callbacks is also recorded in
+    the callback-time histogram and in a histogram named after the
+    handler's class, so that the statistics server can show which
+    classes use the most time.
+
+    Callbacks nest; EventLoop::dispatch() may lead to a
+    Query::notify(), for example. Each CallbackTimer logs and records
+    per-class only its own time, that is, its time minus that of the
+    callbacks nested within it. Only the outermost CallbackTimer is
+    counted and recorded in callback-time, and its sampling decision
+    applies to the nested ones too.
+
+    If both settings are 0, CallbackTimer does nothing at all.
+*/
+
+
+/*! Starts timing a call to \a h's execute(). */
+
+CallbackTimer::CallbackTimer( const EventHandler * h )
+    : type( 0 ), started( 0 ), children( 0 ), parent( 0 ), sampled( false )
+{
+    start();
+    if ( started )
+        type = typeid( *h ).name();
+}
+
+
+/*! Starts timing the EventLoop's dispatch of events to \a c. */
+
+CallbackTimer::CallbackTimer( const Connection * c )
+    : type( 0 ), started( 0 ), children( 0 ), parent( 0 ), sampled( false )
+{
+    start();
+    if ( started )
+        type = typeid( *c ).name();
+}
+
+
+/*! This private helper starts the clock, unless both
+    slow-callback-threshold and callback-sample-interval are 0.
+*/
+
+void CallbackTimer::start()
+{
+    if ( !::callbackTimingSetUp ) {
+        ::callbackTimingSetUp = true;
+        ::slowCallbackThreshold =
+            Configuration::scalar( Configuration::SlowCallbackThreshold );
+        ::callbackSampleInterval =
+            Configuration::scalar( Configuration::CallbackSampleInterval );
+    }
+    if ( !::slowCallbackThreshold && !::callbackSampleInterval )
+        return;
+
+    started = timeInMicroseconds();
+    parent = ::innermostCallback;
+    ::innermostCallback = this;
+    if ( parent ) {
+        sampled = parent->sampled;
+    }
+    else {
+        ::callbacks++;
+        sampled = ::callbackSampleInterval &&
+                  ::callbacks % ::callbackSampleInterval == 0;
+    }
+}
+
+
+/*! Returns a readable version of the compiler's name for a type, \a
+    mangled.
+*/
+
+static EString typeName( const char * mangled )
+{
+    int status = 0;
+    char * n = abi::__cxa_demangle( mangled, 0, 0, &status );
+    if ( !n )
+        return mangled;
+    EString r( n );
+    ::free( n );
+    return r;
+}
+
+
+/*! Stops the clock, and logs and/or records the time taken. */
+
+CallbackTimer::~CallbackTimer()
+{
+    if ( !started )
+        return;
+
+    uint t = timeInMicroseconds() - started;
+    uint own = 0;
+    if ( t > children )
+        own = t - children;
+    ::innermostCallback = parent;
+    if ( parent )
+        parent->children += t;
+
+    EString n;
+    if ( sampled ) {
+        n = typeName( type );
+        if ( !parent ) {
+            if ( !::callbackTimes )
+                ::callbackTimes = new GraphableHistogram( "callback-time" );
+            ::callbackTimes->addNumber( t );
+        }
+        EString hn( "callback-time-" + n );
+        GraphableHistogram * h = GraphableHistogram::find( hn );
+        if ( !h && ::callbackTypes < ::maxCallbackTypes ) {
+            ::callbackTypes++;
+            h = new GraphableHistogram( hn );
+        }
+        if ( h )
+            h->addNumber( own );
+    }
+
+    if ( ::slowCallbackThreshold && own / 1000 >= ::slowCallbackThreshold ) {
+        if ( n.isEmpty() )
+            n = typeName( type );
+        ::log( "Slow callback: " + n + " kept the event loop busy for " +
+               fn( own / 1000 ) + "ms", Log::Significant );
+    }
+}
@@ -7,6 +7,7 @@
 
 
 class Connection;
+class EventHandler;
 
 
 class EventLoop
@@ -41,6 +42,8 @@ public:
     virtual void addTimer( class Timer * );
     virtual void removeTimer( class Timer * );
 
+    void defer( class EventHandler * );
+
     void setConnectionCounts();
 
     void shutdownSSL();
@@ -50,9 +53,31 @@ public:
 
     virtual void freeMemory();
 
+private:
+    void runDeferred( class EventHandler * );
+
 private:
     class LoopData *d;
 };
 
 
+class CallbackTimer
+{
+public:
+    CallbackTimer( const EventHandler * );
+    CallbackTimer( const Connection * );
+    ~CallbackTimer();
+
+private:
+    void start();
+
+private:
+    const char * type;
+    int64 started;
+    int64 children;
+    CallbackTimer * parent;
+    bool sampled;
+};
+
+
 #endif
@@ -4,12 +4,18 @@
 
 #include "allocator.h"
 #include "eventloop.h"
+#include "buffer.h"
+#include "server.h"
 #include "list.h"
+#include "dict.h"
 
 #include <time.h> // time()
+#include <unistd.h> // getpid()
 
 
 static List<GraphableNumber> * numbers = 0;
+static Dict<GraphableHistogram> * histograms = 0;
+static List<GraphableHistogram> * histogramList = 0;
 
 
 static const uint graphableHistorySize = 960; // 15 minutes and a little bit
@@ -19,14 +25,16 @@ class GraphableNumberData
     : public Garbage
 {
 public:
-    GraphableNumberData(): min( 0 ), max( 0 ) {
+    GraphableNumberData()
+        : type( GraphableNumber::Gauge ), min( 0 ), max( 0 ) {
         uint i = 0;
         while ( i < graphableHistorySize )
             values[i++] = 0;
-        setFirstNonPointer( &min );
+        setFirstNonPointer( &type );
     }
     EString name;
     // no pointers after this line
+    GraphableNumber::Type type;
     uint min;
     uint max;
     uint values[::graphableHistorySize];
@@ -193,6 +201,24 @@ EString GraphableNumber::name() const
 }
 
 
+/*! Returns Counter if this number only ever increases, and Gauge
+    (the default) if it may go up and down.
+*/
+
+GraphableNumber::Type GraphableNumber::type() const
+{
+    return d->type;
+}
+
+
+/*! Records that this number is of Type \a t. */
+
+void GraphableNumber::setType( Type t )
+{
+    d->type = t;
+}
+
+
 /*! \class GraphableCounter graph.h
 
     The GraphableCounter class provides a tick counter; you can tell
@@ -205,6 +231,7 @@ EString GraphableNumber::name() const
 GraphableCounter::GraphableCounter( const EString & name )
     : GraphableNumber( name )
 {
+    setType( Counter );
     setValue( 0 );
 }
 
@@ -263,6 +290,147 @@ void GraphableDataSet::addNumber( uint n )
 }
 
 
+// the upper bounds of the GraphableHistogram buckets; 1-2.5-5 per
+// decade, and a last bucket for everything bigger.
+static const uint bucketLimits[] = {
+    100, 250, 500,
+    1000, 2500, 5000,
+    10000, 25000, 50000,
+    100000, 250000, 500000,
+    1000000, 2500000, 5000000,
+    10000000, UINT_MAX
+};
+static const uint numBuckets = sizeof( bucketLimits ) / sizeof( uint );
+
+
+class GraphableHistogramData
+    : public Garbage
+{
+public:
+    GraphableHistogramData(): count( 0 ), sum( 0 ) {
+        uint i = 0;
+        while ( i < numBuckets )
+            buckets[i++] = 0;
+        setFirstNonPointer( &count );
+    }
+    EString name;
+    // no pointers after this line
+    uint count;
+    int64 sum;
+    uint buckets[::numBuckets];
+};
+
+
+/*! \class GraphableHistogram graph.h
+
+    The GraphableHistogram class counts how many numbers fall into
+    each of a fixed set of buckets, and keeps their sum and count.
+
+    Unlike GraphableNumber it keeps no history; the counts only
+    increase. The buckets are chosen to suit times in microseconds,
+    from 100 (0.1ms) up to 10000000 (10s) and beyond.
+
+    Histograms are registered by name, can be found using find(), and
+    are dumped by GraphDumper.
+*/
+
+
+/*! Constructs an empty histogram called \a name. */
+
+GraphableHistogram::GraphableHistogram( const EString & name )
+    : d( new GraphableHistogramData )
+{
+    d->name = name;
+    if ( !histograms ) {
+        histograms = new Dict<GraphableHistogram>;
+        Allocator::addEternal( histograms, "histograms for statistics" );
+        histogramList = new List<GraphableHistogram>;
+        Allocator::addEternal( histogramList, "histograms for statistics" );
+    }
+    histograms->insert( name, this );
+    histogramList->append( this );
+}
+
+
+/*! Records \a n in the right bucket. */
+
+void GraphableHistogram::addNumber( uint n )
+{
+    uint i = 0;
+    while ( n > bucketLimits[i] )
+        i++;
+    d->buckets[i]++;
+    d->count++;
+    d->sum += n;
+}
+
+
+/*! Returns the name supplied to this object's constructor. */
+
+EString GraphableHistogram::name() const
+{
+    return d->name;
+}
+
+
+/*! Returns the number of buckets in each histogram. */
+
+uint GraphableHistogram::buckets()
+{
+    return numBuckets;
+}
+
+
+/*! Returns the upper bound (inclusive) of bucket \a i. The last
+    bucket's limit is UINT_MAX.
+*/
+
+uint GraphableHistogram::bucketLimit( uint i )
+{
+    if ( i >= numBuckets )
+        return UINT_MAX;
+    return bucketLimits[i];
+}
+
+
+/*! Returns the number of numbers that fell into bucket \a i. */
+
+uint GraphableHistogram::bucketCount( uint i ) const
+{
+    if ( i >= numBuckets )
+        return 0;
+    return d->buckets[i];
+}
+
+
+/*! Returns the number of numbers added. */
+
+uint GraphableHistogram::count() const
+{
+    return d->count;
+}
+
+
+/*! Returns the sum of all numbers added. */
+
+int64 GraphableHistogram::sum() const
+{
+    return d->sum;
+}
+
+
+/*! Returns the histogram called \a name, or a null pointer if there
+    isn't one.
+*/
+
+GraphableHistogram * GraphableHistogram::find( const EString & name )
+{
+    if ( !histograms )
+        return 0;
+    return histograms->find( name );
+}
+
+
 /*! \class GraphDumper graph.h
     This Connection subclass is responsible for transferring statistics
     en masse to any client that asks.
@@ -271,6 +439,11 @@ void GraphableDataSet::addNumber( uint n )
 /*! Dumps a frightful amount of data on the socket \a fd and closes it
     at once. The EventLoop will flush the data and make this object go
     away when it can.
+
+    Each GraphableNumber is dumped as its name followed by time:value
+    pairs. Each GraphableHistogram follows as its name, le=limit:count
+    pairs (cumulative, with "inf" for the last limit), sum:s and
+    count:n.
 */
 
 GraphDumper::GraphDumper( int fd )
@@ -307,6 +480,31 @@ GraphDumper::GraphDumper( int fd )
         }
         ++i;
     }
+    List<GraphableHistogram>::Iterator h( histogramList );
+    while ( h ) {
+        l.truncate();
+        l.append( h->name() );
+        uint b = 0;
+        uint c = 0;
+        while ( b < GraphableHistogram::buckets() ) {
+            c += h->bucketCount( b );
+            l.append( " le=" );
+            if ( GraphableHistogram::bucketLimit( b ) == UINT_MAX )
+                l.append( "inf" );
+            else
+                l.appendNumber( GraphableHistogram::bucketLimit( b ) );
+            l.append( ":" );
+            l.appendNumber( c );
+            b++;
+        }
+        l.append( " sum:" );
+        l.append( fn( h->sum() ) );
+        l.append( " count:" );
+        l.appendNumber( h->count() );
+        l.append( "\r\n" );
+        enqueue( l );
+        ++h;
+    }
     setTimeoutAfter( 0 );
 }
 
@@ -315,3 +513,174 @@ void GraphDumper::react( Event )
 {
     setState( Closing );
 }
+
+
+class MetricsServerData
+    : public Garbage
+{
+public:
+    MetricsServerData(): Garbage() {}
+    EString request;
+};
+
+
+/* Returns \a n with the characters Prometheus doesn't permit in
+   metric names replaced, and the "aox_" prefix added.
+*/
+
+static EString metricName( const EString & n )
+{
+    EString r( "aox_" );
+    uint i = 0;
+    while ( i < n.length() ) {
+        char c = n[i];
+        if ( ( c >= 'a' && c <= 'z' ) || ( c >= 'A' && c <= 'Z' ) ||
+             ( c >= '0' && c <= '9' ) )
+            r.append( c );
+        else
+            r.append( '_' );
+        i++;
+    }
+    return r;
+}
+
+
+/* Returns \a us (in microseconds) as a decimal number of seconds. */
+
+static EString seconds( int64 us )
+{
+    EString r = fn( us / 1000000 );
+    uint f = (uint)( us % 1000000 );
+    if ( f ) {
+        EString fraction = fn( f + 1000000 ).mid( 1 );
+        while ( fraction.endsWith( "0" ) )
+            fraction.truncate( fraction.length() - 1 );
+        r.append( "." );
+        r.append( fraction );
+    }
+    return r;
+}
+
+
+/*! \class MetricsServer graph.h
+
+    The MetricsServer class provides the current value of every
+    GraphableNumber and GraphableHistogram in the Prometheus text
+    exposition format, via a minimal HTTP/1.0 server.
+
+    Unlike GraphDumper, it provides only the current values, so the
+    cost of each request depends on the number of metrics, not on
+    the amount of history kept. GraphableCounter objects are exposed
+    as counters, other GraphableNumber objects as gauges, and
+    histograms (which hold microseconds) as histograms in seconds.
+    Each sample is labelled with the server name and process ID.
+*/
+
+
+/*! Constructs a MetricsServer to answer one request on \a fd. */
+
+MetricsServer::MetricsServer( int fd )
+    : Connection( fd, Connection::GraphDumper ), d( new MetricsServerData )
+{
+    EventLoop::global()->addConnection( this );
+    setTimeoutAfter( 10 );
+}
+
+
+void MetricsServer::react( Event e )
+{
+    switch ( e ) {
+    case Read:
+        while ( state() == Connected ) {
+            EString * l = readBuffer()->removeLine();
+            if ( !l )
+                break;
+            if ( d->request.isEmpty() )
+                d->request = l->simplified();
+            else if ( l->isEmpty() )
+                respond();
+        }
+        break;
+    case Connect:
+        break;
+    case Timeout:
+    case Shutdown:
+    case Error:
+    case Close:
+        setState( Closing );
+        break;
+    }
+}
+
+
+/*! Sends the response to the request and closes the connection. */
+
+void MetricsServer::respond()
+{
+    EString method = d->request.section( " ", 1 );
+    EString path = d->request.section( " ", 2 );
+    if ( method != "GET" && method != "HEAD" ) {
+        enqueue( "HTTP/1.0 405 Method Not Allowed\r\n"
+                 "Allow: GET, HEAD\r\n\r\n" );
+        setState( Closing );
+        return;
+    }
+    if ( path != "/metrics" && path != "/" ) {
+        enqueue( "HTTP/1.0 404 Not Found\r\n\r\n" );
+        setState( Closing );
+        return;
+    }
+
+    EString labels( "process=\"" + Server::name() + "\"," );
+    labels.append( "pid=\"" + fn( getpid() ) + "\"" );
+
+    EString b;
+    List<GraphableNumber>::Iterator i( numbers );
+    while ( i ) {
+        EString n = metricName( i->name() );
+        if ( i->type() == GraphableNumber::Counter ) {
+            n.append( "_total" );
+            b.append( "# TYPE " + n + " counter\n" );
+        }
+        else {
+            b.append( "# TYPE " + n + " gauge\n" );
+        }
+        b.append( n + "{" + labels + "} " );
+        b.appendNumber( i->lastValue() );
+        b.append( "\n" );
+        ++i;
+    }
+
+    List<GraphableHistogram>::Iterator h( histogramList );
+    while ( h ) {
+        EString n = metricName( h->name() ) + "_seconds";
+        b.append( "# TYPE " + n + " histogram\n" );
+        uint c = 0;
+        uint j = 0;
+        while ( j < GraphableHistogram::buckets() ) {
+            c += h->bucketCount( j );
+            b.append( n + "_bucket{" + labels + ",le=\"" );
+            if ( GraphableHistogram::bucketLimit( j ) == UINT_MAX )
+                b.append( "+Inf" );
+            else
+                b.append( seconds( GraphableHistogram::bucketLimit( j ) ) );
+            b.append( "\"} " );
+            b.appendNumber( c );
+            b.append( "\n" );
+            j++;
+        }
+        b.append( n + "_sum{" + labels + "} " + seconds( h->sum() ) + "\n" );
+        b.append( n + "_count{" + labels + "} " );
+        b.appendNumber( h->count() );
+        b.append( "\n" );
+        ++h;
+    }
+
+    enqueue( "HTTP/1.0 200 OK\r\n"
+             "Content-Type: text/plain; version=0.0.4\r\n"
+             "Content-Length: " + fn( b.length() ) + "\r\n"
+             "\r\n" );
+    if ( method == "GET" )
+        enqueue( b );
+    setState( Closing );
+}
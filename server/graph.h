@@ -13,6 +13,9 @@ class GraphableNumber
 public:
     GraphableNumber( const EString & );
 
+    enum Type { Gauge, Counter };
+    Type type() const;
+
     void setValue( uint );
     uint maximumSince( uint ) const;
     uint minimumSince( uint ) const;
@@ -24,6 +27,9 @@ public:
     uint youngestTime() const;
     uint value( uint );
 
+protected:
+    void setType( Type );
+
 private:
     class GraphableNumberData * d;
     void clearOldHistory( uint );
@@ -53,6 +59,29 @@ private:
 };
 
 
+class GraphableHistogram
+    : public Garbage
+{
+public:
+    GraphableHistogram( const EString & );
+
+    void addNumber( uint );
+
+    EString name() const;
+
+    static uint buckets();
+    static uint bucketLimit( uint );
+    uint bucketCount( uint ) const;
+    uint count() const;
+    int64 sum() const;
+
+    static GraphableHistogram * find( const EString & );
+
+private:
+    class GraphableHistogramData * d;
+};
+
+
 class GraphDumper
     : public Connection
 {
@@ -63,4 +92,18 @@ public:
 };
 
 
+class MetricsServer
+    : public Connection
+{
+public:
+    MetricsServer( int );
+
+    void react( Event );
+
+private:
+    class MetricsServerData * d;
+    void respond();
+};
+
+
 #endif
@@ -4,6 +4,7 @@
 
 #include "eventloop.h"
 #include "estring.h"
+#include "buffer.h"
 #include "server.h"
 #include "connection.h"
 #include "configuration.h"
@@ -14,29 +15,23 @@
 #include <stdio.h>
 // gettimeofday
 #include <sys/time.h>
-// localtime
-#include <time.h>
 // openlog, syslog
 #include <syslog.h>
 
 
-/* This static function returns a nicely-formatted timestamp. */
+// if this much is waiting to be written to the log server, we drop
+// further debug/info/significant lines rather than use more memory
+static const uint maxBacklog = 4 * 1024 * 1024;
 
-static EString time()
+
+/* Appends \a n to \a s as a big-endian number of \a bytes bytes. */
+
+static void appendNumber( EString & s, uint n, uint bytes )
 {
-    struct timeval tv;
-    struct timezone tz;
-    if ( ::gettimeofday( &tv, &tz ) < 0 )
-        return "";
-    struct tm * t = localtime( (const time_t *)&tv.tv_sec );
-
-    // yuck.
-    char result[32];
-    sprintf( result, "%04d-%02d-%02d %02d:%02d:%02d.%03d",
-             t->tm_year + 1900, t->tm_mon+1, t->tm_mday,
-             t->tm_hour, t->tm_min, t->tm_sec,
-             (int)tv.tv_usec/1000 );
-    return result;
+    while ( bytes ) {
+        bytes--;
+        s.append( (char)( ( n >> ( 8 * bytes ) ) & 0xff ) );
+    }
 }
 
 
@@ -47,7 +42,7 @@ class LogClientData
 public:
     LogClientData( int fd, const Endpoint & e, Logger *client )
         : Connection( fd, Connection::LogClient ),
-          logServer( e ), owner( client )
+          logServer( e ), owner( client ), dropped( 0 )
     {
     }
 
@@ -58,12 +53,63 @@ public:
         owner = 0;
     }
 
+    // Anything left over belongs to the old connection, and may end
+    // in the middle of a frame, so we discard it and start afresh.
     void reconnect()
     {
+        writeBuffer()->remove( writeBuffer()->size() );
+        pending.truncate();
         connect( logServer );
+        Connection::enqueue( "name " + name + "\r\n" );
+        Connection::enqueue( "binary\r\n" );
         EventLoop::global()->addConnection( this );
     }
 
+    // Wraps whatever's in pending into a single frame and enqueues it.
+    void flush()
+    {
+        if ( dropped ) {
+            EString m( "Dropped " + fn( dropped ) +
+                       " log lines because the log server was too slow" );
+            dropped = 0;
+            record( "", Log::Error, m );
+        }
+        if ( pending.isEmpty() )
+            return;
+        EString f;
+        f.reserve( pending.length() + 4 );
+        appendNumber( f, pending.length(), 4 );
+        f.append( pending );
+        pending.truncate();
+        Connection::enqueue( f );
+    }
+
+    // Appends one binary log record to pending.
+    void record( const EString & id, Log::Severity s, const EString & m )
+    {
+        struct timeval tv;
+        struct timezone tz;
+        if ( ::gettimeofday( &tv, &tz ) < 0 )
+            tv.tv_sec = tv.tv_usec = 0;
+
+        pending.reserve( pending.length() + id.length() + m.length() + 13 );
+        pending.append( (char)s );
+        appendNumber( pending, tv.tv_sec, 4 );
+        appendNumber( pending, tv.tv_usec / 1000, 2 );
+        appendNumber( pending, id.length(), 2 );
+        pending.append( id );
+        appendNumber( pending, m.length(), 4 );
+        pending.append( m );
+    }
+
+    // Called once per event loop iteration, so everything logged
+    // during one iteration goes out as one frame.
+    bool canWrite()
+    {
+        flush();
+        return Connection::canWrite();
+    }
+
     // The log server isn't supposed to send us anything.
     void react( Event e ) {
         switch ( e ) {
@@ -71,8 +117,11 @@ public:
         case Timeout:
             break;
         case Shutdown:
-            if ( state() == Connected )
-                enqueue( "shutdown\r\n" );
+            if ( state() == Connected ) {
+                // an empty frame means shutdown
+                flush();
+                Connection::enqueue( EString( "\0\0\0\0", 4 ) );
+            }
             break;
         case Read:
         case Close:
@@ -87,6 +136,8 @@ public:
     Endpoint logServer;
     Logger *owner;
     EString name;
+    EString pending;
+    uint dropped;
 };
 
 
@@ -96,6 +147,11 @@ public:
     This is the Logger that's used throughout most of the system.
     All programs that want to use the regular log server must call
     LogClient::setup() at startup.
+
+    After naming itself, the client switches the connection to the
+    binary protocol (see LogServer), and sends everything logged
+    during one event loop iteration as one frame. If the log server
+    falls far behind, less important lines are dropped and counted.
 */
 
 /*! Creates a new LogClient.  This constructor is usable only via
@@ -138,16 +194,15 @@ void LogClient::send( const EString &id, Log::Severity s, const EString & m )
     if ( d->state() == Connection::Invalid )
         d->reconnect();
 
-    EString t( id );
-    t.reserve( m.length() + 35 );
-    t.append( " x/" );
-    t.append( Log::severity( s ) );
-    t.append( " " );
-    t.append( time() );
-    t.append( " " );
-    t.append( m.simplified() );
-    t.append( "\r\n" );
-    d->enqueue( t );
+    if ( s < Log::Error &&
+         d->writeBuffer()->size() + d->pending.length() > maxBacklog ) {
+        d->dropped++;
+        return;
+    }
+
+    d->record( id, s, m );
+    if ( s == Log::Disaster )
+        d->flush();
 }
 
 
@@ -235,6 +290,7 @@ void LogClient::setup( const EString & n )
         }
         client->d->setBlocking( false );
         client->d->enqueue( "name " + client->name() + "\r\n" );
+        client->d->enqueue( "binary\r\n" );
         EventLoop::global()->addConnection( client->d );
     }
 
@@ -4,9 +4,14 @@
 
 #include "integerset.h"
 #include "estringlist.h"
+#include "dbsignal.h"
 #include "mailbox.h"
+#include "server.h"
 #include "event.h"
 #include "query.h"
+#include "cache.h"
+#include "graph.h"
+#include "dict.h"
 #include "user.h"
 
 
@@ -49,6 +54,44 @@ public:
 };
 
 
+static GraphableCounter * cacheHits = 0;
+static GraphableCounter * cacheMisses = 0;
+
+
+class PermissionCache
+    : public Cache
+{
+public:
+    PermissionCache(): Cache( 10 ) {}
+
+    void clear() { rights.clear(); }
+
+    static EString key( User * u, Mailbox * m ) {
+        return u->login().utf8() + "/" + fn( m->id() );
+    }
+
+    Dict<EString> rights;
+};
+
+
+static PermissionCache * cache = 0;
+
+
+class PermissionWatcher
+    : public EventHandler
+{
+public:
+    PermissionWatcher(): EventHandler() {
+        (void)new DatabaseSignal( "permissions_updated", this );
+        (void)new DatabaseSignal( "mailboxes_updated", this );
+    }
+    void execute() {
+        if ( ::cache )
+            ::cache->clear();
+    }
+};
+
+
 /*! \class Permissions permissions.h
     This class provides RFC 2086 access control lists.
 
@@ -97,6 +140,12 @@ public:
     verify that a user has a given right, and will notify an event
     handler when it's ready() to say whether the access is allowed()
     or not.
+
+    The rights granted to each user on each mailbox are cached, so
+    that e.g. STATUS on many shared mailboxes doesn't need one query
+    per mailbox. Anything that changes the permissions table must
+    send a "permissions_updated" notification to invalidate the
+    cache (changes to the mailboxes table do so already).
 */
 
 /*! Constructs a Permissions object for \a mailbox and \a authid with
@@ -183,7 +232,28 @@ void Permissions::execute()
             d->allowed[Read] = true;
         }
 
-        // For everyone else, we have to check.
+        // For everyone else, we may have checked already.
+        if ( Server::useCache() ) {
+            if ( !::cacheHits ) {
+                ::cacheHits = new GraphableCounter( "permission-cache-hits" );
+                ::cacheMisses =
+                    new GraphableCounter( "permission-cache-misses" );
+            }
+            EString * rights = 0;
+            if ( ::cache )
+                rights = ::cache->rights.find(
+                    PermissionCache::key( d->user, d->mailbox ) );
+            if ( rights ) {
+                ::cacheHits->tick();
+                allow( *rights );
+                d->ready = true;
+                d->owner = 0;
+                return;
+            }
+            ::cacheMisses->tick();
+        }
+
+        // If not, we have to check.
         d->q = new Query( "select * from permissions "
                           "where mailbox=any($1) and "
                           "(identifier=$2 or"
@@ -226,10 +296,19 @@ void Permissions::execute()
             p.append( r->getEString( "rights" ) );
     }
 
-    if ( p.isEmpty() )
-        allow( "l" );
-    else
-        allow( p.join( "" ) ); // ooooh.
+    EString rights( "l" );
+    if ( !p.isEmpty() )
+        rights = p.join( "" ); // ooooh.
+    allow( rights );
+
+    if ( Server::useCache() && !d->q->failed() ) {
+        if ( !::cache ) {
+            ::cache = new PermissionCache;
+            (void)new PermissionWatcher;
+        }
+        ::cache->rights.insert( PermissionCache::key( d->user, d->mailbox ),
+                                new EString( rights ) );
+    }
 
     d->ready = true;
     d->owner->execute();
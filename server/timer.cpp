@@ -133,6 +133,7 @@ void Timer::notify()
 
     Scope s( d->owner->log() );
     try {
+        CallbackTimer t( d->owner );
         d->owner->execute();
     }
     catch ( const Exception& e ) {
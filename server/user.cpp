@@ -5,10 +5,21 @@
 #include "helperrowcreator.h"
 #include "configuration.h"
 #include "transaction.h"
+#include "dbsignal.h"
 #include "address.h"
+#include "entropy.h"
 #include "mailbox.h"
+#include "server.h"
 #include "query.h"
 #include "codec.h"
+#include "cache.h"
+#include "graph.h"
+#include "dict.h"
+#include "md5.h"
+
+#include <time.h> // time(0)
+
+
 class UserData
     : public Garbage
 {
@@ -34,6 +45,7 @@ public:
     Transaction * t;
     EventHandler * user;
     EString error;
+    EString key;
     User::State state;
 
     enum Operation {
@@ -46,10 +58,94 @@ public:
 };
 
 
+// how long (in seconds) a refreshed user may be used without asking
+// the database again
+static const uint lifetime = 30;
+
+
+class UserCacheEntry
+    : public Garbage
+{
+public:
+    UserCacheEntry( Row * r )
+        : Garbage(), row( r ), expires( time( 0 ) + lifetime ) {}
+    Row * row;
+    uint expires;
+    EString verifier;
+};
+
+
+class UserCache
+    : public Cache
+{
+public:
+    UserCache(): Cache( 3 ) {}
+    void clear() { entries.clear(); }
+
+    Dict<UserCacheEntry> entries;
+};
+
+
+static UserCache * cache = 0;
+static GraphableCounter * cacheHits = 0;
+static GraphableCounter * cacheMisses = 0;
+static EString * verifierKey = 0;
+
+
+class UserWatcher
+    : public EventHandler
+{
+public:
+    UserWatcher(): EventHandler() {
+        (void)new DatabaseSignal( "users_updated", this );
+        (void)new DatabaseSignal( "aliases_updated", this );
+        (void)new DatabaseSignal( "mailboxes_updated", this );
+    }
+    void execute() {
+        if ( ::cache )
+            ::cache->clear();
+    }
+};
+
+
+static UserCacheEntry * cacheEntry( const EString & key )
+{
+    if ( key.isEmpty() || !::cache )
+        return 0;
+    UserCacheEntry * e = ::cache->entries.find( key );
+    if ( e && e->expires < (uint)time( 0 ) ) {
+        ::cache->entries.remove( key );
+        e = 0;
+    }
+    return e;
+}
+
+
+/*! Returns a digest of \a secret which can be kept in memory in place
+    of the secret itself. The digest is keyed with a random value, so
+    it's of no use outside this process.
+*/
+
+static EString verifier( const UString & secret )
+{
+    if ( !::verifierKey ) {
+        ::verifierKey = new EString( Entropy::asString( 16 ) );
+        Allocator::addEternal( ::verifierKey, "user secret verifier key" );
+    }
+    return MD5::HMAC( *::verifierKey, secret.utf8() );
+}
+
+
 /*! \class User user.h
 
     The User class models a single Archiveopteryx user, which may be
     able to log in, own Mailbox objects, etc.
+
+    The result of refresh() is cached for a short while, so that a
+    burst of logins (e.g. after a network outage) doesn't require one
+    query per login. The cache is discarded when the users, aliases
+    or mailboxes tables change, so anything that changes the users
+    table must send a "users_updated" notification.
 */
 
 
@@ -266,14 +362,72 @@ static PreparedStatement * psl;
 static PreparedStatement * psa;
 
 
+/*! This private helper sets up \a d from the users row \a r, as
+    retrieved by refresh().
+*/
+
+static void parseRow( UserData * d, Row * r )
+{
+    d->id = r->getInt( "id" );
+    d->login = r->getUString( "login" );
+    if ( r->isNull( "secret" ) )
+        d->secret.truncate();
+    else
+        d->secret = r->getUString( "secret" );
+    d->inboxId = r->getInt( "inbox" );
+    if ( r->isNull( "ldapdn" ) )
+        d->ldapdn.truncate();
+    else
+        d->ldapdn = r->getUString( "ldapdn" );
+    UString tmp = r->getUString( "parentspace" );
+    tmp.append( '/' );
+    tmp.append( d->login );
+    d->home = Mailbox::obtain( tmp, true );
+    d->home->setOwner( d->id );
+    if ( r->isNull( "localpart" ) ) {
+        d->address = new Address();
+    }
+    else {
+        UString n = r->getUString( "name" );
+        UString l = r->getUString( "localpart" );
+        UString h = r->getUString( "domain" );
+        d->address = new Address( n, l, h );
+    }
+    d->quota = r->getBigint( "quota" );
+    d->state = User::Refreshed;
+}
+
+
 /*! Starts refreshing this object from the database, and remembers to
     call \a user when the refresh is complete.
+
+    If a recent result is cached, refresh() uses that at once and
+    does not call \a user.
 */
 
 void User::refresh( EventHandler * user )
 {
     if ( d->q )
         return;
+
+    d->key.truncate();
+    if ( !d->login.isEmpty() && Server::useCache() ) {
+        if ( !::cacheHits ) {
+            ::cacheHits = new GraphableCounter( "user-cache-hits" );
+            ::cacheMisses = new GraphableCounter( "user-cache-misses" );
+        }
+        d->key = d->login.titlecased().utf8();
+        UserCacheEntry * e = cacheEntry( d->key );
+        if ( e ) {
+            ::cacheHits->tick();
+            d->state = Nonexistent;
+            if ( e->row )
+                parseRow( d, e->row );
+            return;
+        }
+        ::cacheMisses->tick();
+    }
+
     d->user = user;
     if ( !psl ) {
         psl = new PreparedStatement(
@@ -326,34 +480,15 @@ void User::refreshHelper()
 
     d->state = Nonexistent;
     Row * r = d->q->nextRow();
-    if ( r ) {
-        d->id = r->getInt( "id" );
-        d->login = r->getUString( "login" );
-        if ( r->isNull( "secret" ) )
-            d->secret.truncate();
-        else
-            d->secret = r->getUString( "secret" );
-        d->inboxId = r->getInt( "inbox" );
-        if ( r->isNull( "ldapdn" ) )
-            d->ldapdn.truncate();
-        else
-            d->ldapdn = r->getUString( "ldapdn" );
-        UString tmp = r->getUString( "parentspace" );
-        tmp.append( '/' );
-        tmp.append( d->login );
-        d->home = Mailbox::obtain( tmp, true );
-        d->home->setOwner( d->id );
-        if ( r->isNull( "localpart" ) ) {
-            d->address = new Address();
-        }
-        else {
-            UString n = r->getUString( "name" );
-            UString l = r->getUString( "localpart" );
-            UString h = r->getUString( "domain" );
-            d->address = new Address( n, l, h );
+    if ( !d->key.isEmpty() && !d->q->failed() ) {
+        if ( !::cache ) {
+            ::cache = new UserCache;
+            (void)new UserWatcher;
         }
-        d->quota = r->getBigint( "quota" );
-        d->state = Refreshed;
+        ::cache->entries.insert( d->key, new UserCacheEntry( r ) );
+    }
+    if ( r ) {
+        parseRow( d, r );
         d->q = 0;
     }
     if ( d->user )
@@ -459,6 +594,7 @@ void User::createHelper()
         q3->bind( 2, m );
         d->t->enqueue( q3 );
 
+        d->t->enqueue( new Query( "notify users_updated", 0 ) );
         d->t->commit();
     }
 
@@ -487,6 +623,7 @@ Query * User::remove( Transaction * t )
     Query * q = new Query( "delete from users where login=$1", 0 );
     q->bind( 1, d->login );
     t->enqueue( q );
+    t->enqueue( new Query( "notify users_updated", 0 ) );
     return q;
 }
 
@@ -517,19 +654,22 @@ Query * User::changeSecret( EventHandler * owner )
 void User::csHelper()
 {
     if ( !d->q ) {
+        d->t = new Transaction( this );
         d->q =
             new Query( "update users set secret=$1 where login=$2",
                        this );
         d->q->bind( 1, d->secret );
         d->q->bind( 2, d->login );
-        d->q->execute();
+        d->t->enqueue( d->q );
+        d->t->enqueue( new Query( "notify users_updated", 0 ) );
+        d->t->commit();
     }
 
-    if ( !d->q->done() )
+    if ( !d->t->done() )
         return;
 
-    if ( d->q->failed() )
-        d->result->setError( d->q->error() );
+    if ( d->t->failed() )
+        d->result->setError( d->t->error() );
     else
         d->result->setState( Query::Completed );
 
@@ -572,3 +712,33 @@ int64 User::quota() const
 {
     return d->quota;
 }
+
+
+/*! Returns true if \a secret has recently been verified as this
+    user's secret using setVerified(), and false otherwise.
+
+    Only a digest of the secret is kept, and only for as long as the
+    result of refresh() is cached.
+*/
+
+bool User::verified( const UString & secret ) const
+{
+    UserCacheEntry * e = cacheEntry( d->key );
+    if ( !e || !e->row || e->verifier.isEmpty() )
+        return false;
+    return e->verifier == verifier( secret );
+}
+
+
+/*! Records that \a secret has been verified as this user's secret by
+    some means other than comparing it to secret(), e.g. by binding to
+    an LDAP server. Does nothing unless the user was refreshed from
+    the cache or is being cached.
+*/
+
+void User::setVerified( const UString & secret )
+{
+    UserCacheEntry * e = cacheEntry( d->key );
+    if ( e && e->row )
+        e->verifier = verifier( secret );
+}
@@ -58,6 +58,9 @@ public:
     bool valid();
     EString error() const;
 
+    bool verified( const UString & ) const;
+    void setVerified( const UString & );
+
 private:
     void refreshHelper();
     void createHelper();
@@ -0,0 +1,136 @@
+// Copyright 2009 The Archiveopteryx Developers <info@aox.org>
+
+#include "aliascache.h"
+
+#include "dbsignal.h"
+#include "estring.h"
+#include "server.h"
+#include "event.h"
+#include "graph.h"
+#include "query.h"
+#include "dict.h"
+
+#include <time.h> // time(0)
+
+
+static class AliasCache * c = 0;
+static GraphableCounter * hits = 0;
+static GraphableCounter * misses = 0;
+
+// how long (in seconds) a lookup result may be used
+static const uint lifetime = 60;
+
+
+class AliasCacheEntry
+    : public Garbage
+{
+public:
+    AliasCacheEntry( List<Row> * r )
+        : Garbage(), rows( r ), expires( time( 0 ) + lifetime ) {}
+    List<Row> * rows;
+    uint expires;
+};
+
+
+class AliasCacheData
+    : public Garbage
+{
+public:
+    AliasCacheData(): Garbage() {}
+    Dict<AliasCacheEntry> entries;
+};
+
+
+class AliasWatcher
+    : public EventHandler
+{
+public:
+    AliasWatcher(): EventHandler() {
+        (void)new DatabaseSignal( "aliases_updated", this );
+        (void)new DatabaseSignal( "scripts_updated", this );
+        (void)new DatabaseSignal( "mailboxes_updated", this );
+    }
+    void execute() {
+        if ( ::c )
+            ::c->clear();
+    }
+};
+
+
+/*! \class AliasCache aliascache.h
+
+    The AliasCache class remembers which mailboxes and Sieve scripts
+    an address resolves to, so that mail to the same recipients
+    doesn't have to look up the aliases table each time.
+
+    The cached result for an address is the list of rows returned by
+    the recipient query in Sieve::lookupRecipients(). An empty list
+    means that the address isn't an alias, so negative results are
+    cached too.
+
+    Results are kept for a minute at most. The cache also discards
+    everything when the aliases, scripts or mailboxes tables change,
+    ie. when it sees an "aliases_updated", "scripts_updated" or
+    "mailboxes_updated" notification.
+*/
+
+
+/*! Constructs an empty AliasCache. Should not be called directly,
+    only via insert().
+*/
+
+AliasCache::AliasCache()
+    : Cache( 3 ), d( new AliasCacheData )
+{
+    (void)new AliasWatcher;
+}
+
+
+/*! Returns the rows recorded for \a key, or a null pointer if \a key
+    isn't in the cache or its entry has expired. An empty list means
+    that \a key is known not to be an alias.
+*/
+
+List<Row> * AliasCache::find( const EString & key )
+{
+    if ( !Server::useCache() )
+        return 0;
+
+    if ( !::hits ) {
+        ::hits = new GraphableCounter( "alias-cache-hits" );
+        ::misses = new GraphableCounter( "alias-cache-misses" );
+    }
+
+    AliasCacheEntry * e = 0;
+    if ( ::c )
+        e = ::c->d->entries.find( key );
+    if ( e && e->expires < (uint)time( 0 ) ) {
+        ::c->d->entries.remove( key );
+        e = 0;
+    }
+    if ( !e ) {
+        ::misses->tick();
+        return 0;
+    }
+
+    ::hits->tick();
+    return e->rows;
+}
+
+
+/*! Records that looking up \a key returned \a rows. */
+
+void AliasCache::insert( const EString & key, List<Row> * rows )
+{
+    if ( !Server::useCache() )
+        return;
+    if ( !::c )
+        ::c = new AliasCache;
+    ::c->d->entries.insert( key, new AliasCacheEntry( rows ) );
+}
+
+
+void AliasCache::clear()
+{
+    d->entries.clear();
+}
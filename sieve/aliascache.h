@@ -0,0 +1,30 @@
+// Copyright 2009 The Archiveopteryx Developers <info@aox.org>
+
+#ifndef ALIASCACHE_H
+#define ALIASCACHE_H
+
+#include "cache.h"
+#include "list.h"
+
+class Row;
+class EString;
+
+
+class AliasCache
+    : public Cache
+{
+private:
+    AliasCache();
+
+public:
+    static List<Row> * find( const EString & );
+    static void insert( const EString &, List<Row> * );
+
+    void clear();
+
+private:
+    class AliasCacheData * d;
+};
+
+
+#endif
@@ -453,6 +453,7 @@ bool ManageSieveCommand::putScript()
         d->query->bind( 2, d->name );
         d->query->bind( 3, d->script );
         d->t->enqueue( d->query );
+        d->t->enqueue( new Query( "notify scripts_updated", 0 ) );
 
         d->step = 1;
         d->t->commit();
@@ -556,6 +557,7 @@ bool ManageSieveCommand::setActive()
             d->t->enqueue( q );
             log( "Activating script " + r->getEString( "name" ) );
         }
+        d->t->enqueue( new Query( "notify scripts_updated", 0 ) );
         d->t->commit();
     }
 
@@ -621,6 +623,7 @@ bool ManageSieveCommand::deleteScript()
         q->bind( 1, d->sieve->user()->id() );
         q->bind( 2, d->name );
         d->t->enqueue( q );
+        d->t->enqueue( new Query( "notify scripts_updated", 0 ) );
         if ( d->no.isEmpty() )
             d->t->commit();
     }
@@ -667,6 +670,7 @@ bool ManageSieveCommand::renameScript()
         d->query->bind( 2, from );
         d->query->bind( 3, to );
         d->t->enqueue( d->query );
+        d->t->enqueue( new Query( "notify scripts_updated", 0 ) );
         d->t->commit();
     }
 
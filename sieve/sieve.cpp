@@ -3,6 +3,7 @@
 #include "sieve.h"
 
 #include "md5.h"
+#include "dict.h"
 #include "utf.h"
 #include "date.h"
 #include "html.h"
@@ -21,6 +22,8 @@
 #include "ustringlist.h"
 #include "sievenotify.h"
 #include "sievescript.h"
+#include "sievescriptcache.h"
+#include "aliascache.h"
 #include "sieveaction.h"
 #include "transaction.h"
 #include "spoolmanager.h"
@@ -47,6 +50,21 @@ public:
           softError( false )
     {}
 
+    class Lookup
+        : public Garbage
+    {
+    public:
+        Lookup( Query * query )
+            : Garbage(), q( query ), grouped( false ) {}
+
+        Query * q;
+        bool grouped;
+        EStringList keys;
+        Dict< List<Row> > rows;
+
+        List<Row> * rowsFor( const EString & );
+    };
+
     class Recipient
         : public Garbage
     {
@@ -55,7 +73,7 @@ public:
             : d( data ), address( a ), mailbox( m ),
               done( false ), ok( true ),
               implicitKeep( true ), explicitKeep( false ),
-              sq( 0 ), script( new SieveScript ), user( 0 ), handler( 0 )
+              lookup( 0 ), script( new SieveScript ), user( 0 ), handler( 0 )
         {
             d->recipients.append( this );
         }
@@ -70,7 +88,9 @@ public:
         EString result;
         List<SieveAction> actions;
         List<SieveCommand> pending;
-        Query * sq;
+        UString localpart;
+        EString key;
+        Lookup * lookup;
         SieveScript * script;
         EString error;
         UString prefix;
@@ -78,6 +98,7 @@ public:
         EventHandler * handler;
         UStringList flags;
 
+        void resolve( List<Row> * );
         bool evaluate( SieveCommand * );
         enum Result { True, False, Undecidable };
         Result evaluate( SieveTest * );
@@ -85,6 +106,7 @@ public:
 
     Address * sender;
     List<Recipient> recipients;
+    List<Recipient> unresolved;
     Recipient * currentRecipient;
     List<Address> submissions;
     Date * forwardingDate;
@@ -102,6 +124,108 @@ public:
 };
 
 
+/*! Returns the key used to look up \a localpart and \a domain in
+    the aliases table, and in the AliasCache.
+*/
+
+static EString aliasKey( const UString & localpart, const UString & domain )
+{
+    return localpart.titlecased().utf8() + "@" + domain.titlecased().utf8();
+}
+
+
+/*! Returns the rows the query returned for \a key, grouping all the
+    results by key first if that hasn't been done yet. Returns an
+    empty list if there were none.
+*/
+
+List<Row> * SieveData::Lookup::rowsFor( const EString & key )
+{
+    if ( !grouped ) {
+        grouped = true;
+        Row * r;
+        while ( (r = q->nextRow()) != 0 ) {
+            EString k = aliasKey( r->getUString( "localpart" ),
+                                  r->getUString( "domain" ) );
+            List<Row> * l = rows.find( k );
+            if ( !l ) {
+                l = new List<Row>;
+                rows.insert( k, l );
+            }
+            l->append( r );
+        }
+        EStringList::Iterator k( keys );
+        while ( k ) {
+            if ( !rows.contains( *k ) )
+                rows.insert( *k, new List<Row> );
+            if ( !q->failed() )
+                AliasCache::insert( *k, rows.find( *k ) );
+            ++k;
+        }
+    }
+    List<Row> * l = rows.find( key );
+    if ( !l )
+        l = new List<Row>;
+    return l;
+}
+
+
+/*! Uses \a rows, the result of looking up this recipient's address,
+    to find the recipient's mailbox, owner and active Sieve script. If
+    the address is an alias for more than one mailbox, further
+    recipients are added for the others.
+*/
+
+void SieveData::Recipient::resolve( List<Row> * rows )
+{
+    lookup = 0;
+    Recipient * in = this;
+    List<Row>::Iterator r( rows );
+    while ( r ) {
+        if ( !r->isNull( "mailbox" ) )
+            in->mailbox = Mailbox::find( r->getInt( "mailbox" ) );
+        if ( !r->isNull( "script" ) ) {
+            in->prefix = r->getUString( "namespace" ) + "/" +
+                         r->getUString( "login" ) + "/";
+            in->user = new User;
+            in->user->setLogin( r->getUString( "login" ) );
+            in->user->setId( r->getInt( "userid" ) );
+            in->user->setAddress( new Address( r->getUString( "name" ),
+                                               r->getEString( "localpart" ),
+                                               r->getEString( "domain" ) ) );
+            EString name( r->getEString( "scriptname" ) );
+            EString text( r->getEString( "script" ).crlf() );
+            in->script = SieveScriptCache::find( in->user->id(), name, text );
+            if ( !in->script ) {
+                in->script = new SieveScript;
+                in->script->parse( text );
+                SieveScriptCache::insert( in->user->id(), name,
+                                          text, in->script );
+            }
+            EString errors = in->script->parseErrors();
+            if ( !errors.isEmpty() ) {
+                ::log( "Note: Sieve script for " +
+                       in->user->login().utf8() +
+                       "had parse errors.", Log::Error );
+                EStringList::Iterator i( EStringList::split( '\n', errors ) );
+                while ( i ) {
+                    ::log( "Sieve: " + *i, Log::Error );
+                    ++i;
+                }
+            }
+            List<SieveCommand>::Iterator c( in->script->topLevelCommands() );
+            while ( c ) {
+                in->pending.append( c );
+                ++c;
+            }
+        }
+        ++r;
+        if ( r )
+            in = new SieveData::Recipient( address, 0, d );
+    }
+}
+
+
 SieveData::Recipient * SieveData::recipient( Address * a )
 {
     List<SieveData::Recipient>::Iterator it( recipients );
@@ -168,52 +292,10 @@ void Sieve::execute()
         bool wasReady = ready();
         List<SieveData::Recipient>::Iterator i( d->recipients );
         while ( i ) {
-            if ( i->sq && i->sq->hasResults() ) {
-                Row * r;
-                SieveData::Recipient *in = i;
-                for ( in = i ;
-                      (r = i->sq->nextRow()) ;
-                      in = new SieveData::Recipient( i->address, 0, d) ) {
-                    if ( !r->isNull( "mailbox" ) )
-                        in->mailbox = Mailbox::find( r->getInt( "mailbox" ) );
-                    if ( !r->isNull( "script" ) ) {
-                        in->prefix = r->getUString( "namespace" ) + "/" +
-                                    r->getUString( "login" ) + "/";
-                        in->user = new User;
-                        in->user->setLogin( r->getUString( "login" ) );
-                        in->user->setId( r->getInt( "userid" ) );
-                        in->user->setAddress( new Address(
-                                                 r->getUString( "name" ),
-                                                 r->getEString( "localpart" ),
-                                                 r->getEString( "domain" ) ) );
-                        in->script->parse( r->getEString( "script" ).crlf() );
-                        EString errors = in->script->parseErrors();
-                        if ( !errors.isEmpty() ) {
-                            log( "Note: Sieve script for " +
-                                 in->user->login().utf8() +
-                                 "had parse errors.", Log::Error );
-                            EString prefix = "Sieve script for " +
-                                            in->user->login().utf8();
-                            EStringList::Iterator i(
-                                EStringList::split( '\n', errors ) );
-                            while ( i ) {
-                                log( "Sieve: " + *i, Log::Error );
-                                ++i;
-                            }
-                        }
-                        List<SieveCommand>::Iterator
-                            c(in->script->topLevelCommands());
-                        while ( c ) {
-                            in->pending.append( c );
-                            ++c;
-                        }
-                    }
-                }
-                i->sq = 0;
-            }
-            if ( i->sq && i->sq->done() )
-                i->sq = 0;
+            SieveData::Recipient * r = i;
             ++i;
+            if ( r->lookup && r->lookup->q->done() )
+                r->resolve( r->lookup->rowsFor( r->key ) );
         }
         if ( ready() && !wasReady ) {
             i = d->recipients.first();
@@ -483,18 +565,6 @@ void Sieve::addRecipient( Address * address, EventHandler * user )
 
     r->handler = user;
 
-    r->sq = new Query( "select al.mailbox, s.script, m.owner, "
-                       "n.name as namespace, u.id as userid, u.login, "
-                       "a.name, a.localpart::text, a.domain::text "
-                       "from aliases al "
-                       "join addresses a on (al.address=a.id) "
-                       "join mailboxes m on (al.mailbox=m.id) "
-                       "left join scripts s on "
-                       " (s.owner=m.owner and s.active='t') "
-                       "left join users u on (s.owner=u.id) "
-                       "left join namespaces n on (u.parentspace=n.id) "
-                       "where m.deleted='f' and "
-                       "a.localpart=$1 and a.domain=$2", this );
     UString localpart( address->localpart() );
     if ( Configuration::toggle( Configuration::UseSubaddressing ) ) {
         EString sep( Configuration::text( Configuration::AddressSeparator ) );
@@ -516,9 +586,71 @@ void Sieve::addRecipient( Address * address, EventHandler * user )
                 localpart = localpart.mid( 0, n );
         }
     }
-    r->sq->bind( 1, localpart );
-    r->sq->bind( 2, address->domain() );
-    r->sq->execute();
+    r->localpart = localpart;
+    r->key = aliasKey( localpart, address->domain() );
+
+    List<Row> * rows = AliasCache::find( r->key );
+    if ( rows )
+        r->resolve( rows );
+    else
+        d->unresolved.append( r );
+}
+
+
+/*! Looks up all the recipients added by addRecipient() since the last
+    call, using a single query. The event handlers given to
+    addRecipient() are called when the results are available.
+
+    Recipients whose addresses were found in the AliasCache don't
+    need to be looked up, so addRecipient() resolves those at once.
+*/
+
+void Sieve::lookupRecipients()
+{
+    if ( d->unresolved.isEmpty() )
+        return;
+
+    Scope x( log() );
+
+    Query * q
+        = new Query( "select al.mailbox, s.script, s.name as scriptname, "
+                     "m.owner, n.name as namespace, u.id as userid, "
+                     "u.login, a.name, a.localpart::text, a.domain::text "
+                     "from aliases al "
+                     "join addresses a on (al.address=a.id) "
+                     "join mailboxes m on (al.mailbox=m.id) "
+                     "left join scripts s on "
+                     " (s.owner=m.owner and s.active='t') "
+                     "left join users u on (s.owner=u.id) "
+                     "left join namespaces n on (u.parentspace=n.id) "
+                     "where m.deleted='f' and "
+                     "a.localpart=any($1::citext[]) and "
+                     "a.domain=any($2::citext[])", this );
+    SieveData::Lookup * l = new SieveData::Lookup( q );
+
+    // we look for each combination of localpart and domain, and
+    // rowsFor() picks out the ones we asked for.
+    UStringList localparts;
+    UStringList domains;
+    Dict<SieveData::Recipient> seen;
+    List<SieveData::Recipient>::Iterator i( d->unresolved );
+    while ( i ) {
+        i->lookup = l;
+        if ( !seen.contains( i->key ) ) {
+            seen.insert( i->key, i );
+            l->keys.append( i->key );
+            localparts.append( i->localpart );
+            domains.append( i->address->domain() );
+        }
+        ++i;
+    }
+    d->unresolved.clear();
+
+    if ( l->keys.count() > 1 )
+        log( "Looking up " + fn( l->keys.count() ) + " recipients" );
+    q->bind( 1, localparts );
+    q->bind( 2, domains );
+    q->execute();
 }
 
 
@@ -1865,8 +1997,10 @@ bool Sieve::rejected() const
 
 bool Sieve::ready() const
 {
+    if ( !d->unresolved.isEmpty() )
+        return false;
     List<SieveData::Recipient>::Iterator i( d->recipients );
-    while ( i && !i->sq )
+    while ( i && !i->lookup )
         ++i;
     if ( i )
         return false;
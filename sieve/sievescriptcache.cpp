@@ -0,0 +1,140 @@
+// Copyright 2009 The Archiveopteryx Developers <info@aox.org>
+
+#include "sievescriptcache.h"
+
+#include "sievescript.h"
+#include "dbsignal.h"
+#include "estring.h"
+#include "server.h"
+#include "event.h"
+#include "graph.h"
+#include "dict.h"
+
+
+static class SieveScriptCache * c = 0;
+static GraphableCounter * hits = 0;
+static GraphableCounter * misses = 0;
+
+
+class SieveScriptCacheEntry
+    : public Garbage
+{
+public:
+    SieveScriptCacheEntry( const EString & t, SieveScript * s )
+        : Garbage(), text( t ), script( s ) {}
+    EString text;
+    SieveScript * script;
+};
+
+
+class SieveScriptCacheData
+    : public Garbage
+{
+public:
+    SieveScriptCacheData(): Garbage() {}
+    Dict<SieveScriptCacheEntry> scripts;
+};
+
+
+class SieveScriptWatcher
+    : public EventHandler
+{
+public:
+    SieveScriptWatcher(): EventHandler() {
+        (void)new DatabaseSignal( "scripts_updated", this );
+    }
+    void execute() {
+        if ( ::c )
+            ::c->clear();
+    }
+};
+
+
+static EString key( uint owner, const EString & name )
+{
+    EString r;
+    r.appendNumber( owner );
+    r.append( '/' );
+    r.append( name );
+    return r;
+}
+
+
+/*! \class SieveScriptCache sievescriptcache.h
+
+    The SieveScriptCache class keeps parsed SieveScript objects, so
+    that mail to a user with a large script doesn't cause the script
+    to be parsed once per message.
+
+    Scripts are keyed by their owner's user ID and name. Since the
+    script text is fetched along with the alias anyway, find() also
+    compares it to the text that was parsed, so a stale entry can
+    never be used. The ManageSieve commands which change scripts send
+    a "scripts_updated" notification, and the cache discards
+    everything when it sees one.
+
+    Evaluating a script doesn't modify it, so each parsed script can
+    be shared by all Sieve objects which use it.
+*/
+
+
+/*! Constructs an empty SieveScriptCache. Should not be called
+    directly, only via insert().
+*/
+
+SieveScriptCache::SieveScriptCache()
+    : Cache( 10 ), d( new SieveScriptCacheData )
+{
+    (void)new SieveScriptWatcher;
+}
+
+
+/*! Returns the parsed script called \a name owned by the user with
+    ID \a owner, or a null pointer if the cache doesn't contain it or
+    if its source isn't \a text.
+*/
+
+SieveScript * SieveScriptCache::find( uint owner, const EString & name,
+                                      const EString & text )
+{
+    if ( !Server::useCache() )
+        return 0;
+
+    if ( !::hits ) {
+        ::hits = new GraphableCounter( "sieve-cache-hits" );
+        ::misses = new GraphableCounter( "sieve-cache-misses" );
+    }
+
+    SieveScriptCacheEntry * e = 0;
+    if ( ::c )
+        e = ::c->d->scripts.find( key( owner, name ) );
+    if ( !e || e->text != text ) {
+        ::misses->tick();
+        return 0;
+    }
+
+    ::hits->tick();
+    return e->script;
+}
+
+
+/*! Records that \a script is the result of parsing \a text, which is
+    the script called \a name owned by the user with ID \a owner.
+*/
+
+void SieveScriptCache::insert( uint owner, const EString & name,
+                               const EString & text, SieveScript * script )
+{
+    if ( !Server::useCache() )
+        return;
+    if ( !::c )
+        ::c = new SieveScriptCache;
+    ::c->d->scripts.insert( key( owner, name ),
+                            new SieveScriptCacheEntry( text, script ) );
+}
+
+
+void SieveScriptCache::clear()
+{
+    d->scripts.clear();
+}
@@ -0,0 +1,30 @@
+// Copyright 2009 The Archiveopteryx Developers <info@aox.org>
+
+#ifndef SIEVESCRIPTCACHE_H
+#define SIEVESCRIPTCACHE_H
+
+#include "cache.h"
+
+class EString;
+class SieveScript;
+
+
+class SieveScriptCache
+    : public Cache
+{
+private:
+    SieveScriptCache();
+
+public:
+    static SieveScript * find( uint, const EString &, const EString & );
+    static void insert( uint, const EString &, const EString &,
+                        SieveScript * );
+
+    void clear();
+
+private:
+    class SieveScriptCacheData * d;
+};
+
+
+#endif
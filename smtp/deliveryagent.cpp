@@ -28,7 +28,7 @@ public:
         : messageId( 0 ), t( 0 ),
           qm( 0 ), qs( 0 ), qr( 0 ), message( 0 ), expired( false ),
           dsn( 0 ), injector( 0 ), update( 0 ), client( 0 ),
-          updatedDelivery( false )
+          updatedDelivery( false ), finished( false ), owner( 0 ), id( 0 )
     {}
 
     uint messageId;
@@ -44,6 +44,9 @@ public:
     Query * update;
     SmtpClient * client;
     bool updatedDelivery;
+    bool finished;
+    EventHandler * owner;
+    uint id;
 };
 
 
@@ -53,16 +56,19 @@ public:
 */
 
 /*! Creates a new DeliveryAgent object to deliver the message with the
-    given \a id.
+    given \a id. If \a owner is non-null, it is notified when the
+    agent has finished its work.
 */
 
-DeliveryAgent::DeliveryAgent( uint id )
+DeliveryAgent::DeliveryAgent( uint id, EventHandler * owner )
     : d( new DeliveryAgentData )
 {
     setLog( new Log );
     Scope x( log() );
     log( "Attempting delivery for message " + fn( id ) );
     d->messageId = id;
+    d->owner = owner;
+    d->id = id;
 }
 
 
@@ -72,7 +78,7 @@ DeliveryAgent::DeliveryAgent( uint id )
 
 uint DeliveryAgent::messageId() const
 {
-    return d->messageId;
+    return d->id;
 }
 
 
@@ -85,6 +91,7 @@ void DeliveryAgent::execute()
 
     if ( !d->t ) {
         d->t = new Transaction( this );
+        d->t->setPriority( Query::Delivery );
         d->qm = new Query(
             "select id, sender, current_timestamp > expires_at as expired "
             "from deliveries where message=$1 for update",
@@ -130,6 +137,7 @@ void DeliveryAgent::execute()
         d->t->rollback();
         d->messageId = 0;
         log( "Could not find/lock deliveries row; aborting" );
+        finish();
         return;
     }
 
@@ -151,6 +159,7 @@ void DeliveryAgent::execute()
             d->t->rollback();
             d->messageId = 0;
             log( "Delivery already completed; will do nothing", Log::Debug );
+            finish();
             return;
         }
     }
@@ -212,6 +221,19 @@ void DeliveryAgent::execute()
     }
 
     d->messageId = 0;
+    finish();
+}
+
+
+/*! Notifies the owner, if any, that this agent has finished. */
+
+void DeliveryAgent::finish()
+{
+    d->finished = true;
+    EventHandler * owner = d->owner;
+    d->owner = 0;
+    if ( owner )
+        owner->notify();
 }
 
 
@@ -221,12 +243,25 @@ void DeliveryAgent::execute()
 
 bool DeliveryAgent::working() const
 {
+    if ( d->finished )
+        return false;
     if ( d->t && !d->t->done() )
         return true;
     return false;
 }
 
 
+/*! Returns true if this DeliveryAgent tried to deliver the message
+    and some recipients are still pending, so that the message should
+    be tried again later, and false if not.
+*/
+
+bool DeliveryAgent::retry() const
+{
+    return d->updatedDelivery && d->dsn && d->dsn->deliveriesPending();
+}
+
+
 /*! Begins to fetch a message with the given \a messageId, and returns a
     pointer to the newly-created Message object, which will be filled in
     by the message fetcher.
@@ -18,13 +18,14 @@ class DeliveryAgent
     : public EventHandler
 {
 public:
-    DeliveryAgent( uint );
+    DeliveryAgent( uint, EventHandler * = 0 );
 
     uint messageId() const;
 
     void execute();
 
     bool working() const;
+    bool retry() const;
 
 private:
     class DeliveryAgentData * d;
@@ -35,6 +36,7 @@ private:
     void logDelivery( DSN * );
     Injector * injectBounce( DSN * );
     void updateDelivery();
+    void finish();
 };
 
 
@@ -6,6 +6,7 @@
 #include "smtpcommand.h"
 #include "transaction.h"
 #include "eventloop.h"
+#include "spoolfile.h"
 #include "address.h"
 #include "mailbox.h"
 #include "buffer.h"
@@ -29,7 +30,8 @@ public:
         inputState( SMTP::Command ),
         dialect( SMTP::Smtp ),
         sieve( 0 ), user( 0 ), permittedAddresses( 0 ),
-        recipients( new List<SmtpRcptTo> ), now( 0 ) {}
+        recipients( new List<SmtpRcptTo> ), body( new SpoolFile ),
+        spoolFile( 0 ), now( 0 ) {}
 
     bool executing;
     bool executeAgain;
@@ -41,7 +43,8 @@ public:
     User * user;
     List<Address> * permittedAddresses;
     List<SmtpRcptTo> * recipients;
-    EString body;
+    SpoolFile * body;
+    SpoolFile * spoolFile;
     Date * now;
     EString id;
 
@@ -219,6 +222,10 @@ void SMTP::execute()
                 c->notify();
         }
 
+        // look up all the RCPT TO addresses seen so far at once
+        if ( d->sieve )
+            d->sieve->lookupRecipients();
+
         // see if any old commands may be retired
         i = d->commands.first();
         while ( i && i->done() ) {
@@ -271,11 +278,11 @@ void SMTP::reset()
 {
     if ( d->sieve ||
          ( d->recipients && !d->recipients->isEmpty() ) ||
-         !d->body.isEmpty() )
+         d->body->size() )
         log( "State reset" );
     d->sieve = 0;
     d->recipients = new List<SmtpRcptTo>;
-    d->body.truncate();
+    discardBody();
     d->id.truncate();
     d->now = 0;
 }
@@ -402,21 +409,79 @@ List<SmtpRcptTo> * SMTP::rcptTo() const
 }
 
 
-/*! Records \a b for later recall. reset() clears this. */
+/*! Appends \a b to the message body for later recall. reset() clears
+    this. A large body is kept in a SpoolFile rather than in RAM.
+*/
 
-void SMTP::setBody( const EString & b )
+void SMTP::appendBody( const EString & b )
 {
-    d->body = b;
+    d->body->append( b );
 }
 
 
-/*! Returns what setBody() set. Used for SmtpBdat instances to
-    coordinate the body.
+/*! Appends everything in \a s to the message body. If the body is
+    still empty, \a s simply becomes the body, so that data already
+    spooled to disk isn't written a second time. Otherwise \a s is
+    closed after its contents have been appended.
+*/
+
+void SMTP::appendBody( SpoolFile * s )
+{
+    if ( !d->body->size() ) {
+        d->body->close();
+        d->body = s;
+    }
+    else {
+        d->body->append( s->contents() );
+        s->close();
+    }
+}
+
+
+/*! Discards the message body collected by appendBody(), e.g. because
+    the message was rejected. reset() does this and more.
+*/
+
+void SMTP::discardBody()
+{
+    d->body->close();
+    d->body = new SpoolFile;
+}
+
+
+/*! Returns what appendBody() appended. Used for SmtpData, SmtpBdat
+    and SmtpBurl instances to coordinate the body.
 */
 
 EString SMTP::body() const
 {
-    return d->body;
+    return d->body->contents();
+}
+
+
+/*! Records that \a s is being used to store the input currently being
+    read, so that it can be closed if the connection is closed. \a s
+    may be null.
+*/
+
+void SMTP::setSpoolFile( SpoolFile * s )
+{
+    d->spoolFile = s;
+}
+
+
+/*! Closes the connection, and any SpoolFile used for the message
+    being received.
+*/
+
+void SMTP::close()
+{
+    if ( d ) {
+        if ( d->spoolFile )
+            d->spoolFile->close();
+        d->body->close();
+    }
+    SaslConnection::close();
 }
 
 
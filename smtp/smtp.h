@@ -48,8 +48,14 @@ public:
     void addRecipient( class SmtpRcptTo * );
     List<class SmtpRcptTo> * rcptTo() const;
 
-    void setBody( const EString & );
+    void appendBody( const EString & );
+    void appendBody( class SpoolFile * );
     EString body() const;
+    void discardBody();
+
+    void setSpoolFile( class SpoolFile * );
+
+    void close();
 
     bool isFirstCommand( SmtpCommand * ) const;
 
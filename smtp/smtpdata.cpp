@@ -14,6 +14,8 @@
 #include "imapurl.h"
 #include "mailbox.h"
 #include "buffer.h"
+#include "spoolfile.h"
+#include "eventloop.h"
 #include "graph.h"
 #include "scope.h"
 #include "sieve.h"
@@ -30,13 +32,30 @@ class SmtpDataData
 {
 public:
     SmtpDataData()
-        : state( 2 ), message( 0 ), ok( "OK" )
+        : state( 2 ), message( 0 ), ok( "OK" ), parser( 0 )
     {}
 
     EString body;
     uint state;
     Injectee * message;
     EString ok;
+
+    class Parser
+        : public EventHandler
+    {
+    public:
+        Parser( SmtpData * c ): turn( false ), command( c ) {
+            EventLoop::global()->defer( this );
+        }
+        void execute() {
+            turn = true;
+            command->execute();
+        }
+        bool turn;
+        SmtpData * command;
+    };
+
+    Parser * parser;
 };
 
 
@@ -140,15 +159,14 @@ void SmtpData::execute()
         if ( *line == "." ) {
             d->state = 2;
             server()->setInputState( SMTP::Command );
-            server()->setBody( d->body );
         }
         else if ( (*line)[0] == '.' ) {
-            d->body.append( line->mid( 1 ) );
-            d->body.append( "\r\n" );
+            line->append( "\r\n" );
+            server()->appendBody( line->mid( 1 ) );
         }
         else {
-            d->body.append( *line );
-            d->body.append( "\r\n" );
+            line->append( "\r\n" );
+            server()->appendBody( *line );
         }
     }
 
@@ -156,7 +174,15 @@ void SmtpData::execute()
 
     // state 2: have received CR LF "." CR LF, have not started injection
     if ( d->state == 2 ) {
-        server()->sieve()->setMessage( message( server()->body() ),
+        // parsing may take a while, so we wait for the event loop to
+        // give us a turn.
+        if ( !d->parser )
+            d->parser = new SmtpDataData::Parser( this );
+        if ( !d->parser->turn )
+            return;
+
+        d->body = server()->body();
+        server()->sieve()->setMessage( message( d->body ),
                                        server()->transactionTime() );
         if ( server()->dialect() == SMTP::Submit &&
              d->message->error().isEmpty() &&
@@ -175,6 +201,7 @@ void SmtpData::execute()
             }
             if ( !e.isEmpty() ) {
                 respond( 554, e, "5.7.0" );
+                server()->discardBody();
                 finish();
                 return;
             }
@@ -187,6 +214,7 @@ void SmtpData::execute()
             // have the sender there.
             respond( 554,
                      "Syntax error: " + d->message->error(), "5.6.0" );
+            server()->discardBody();
             finish();
             return;
         }
@@ -256,6 +284,7 @@ void SmtpData::execute()
             else
                 respond( 551, "Injection error: " + server()->sieve()->error(),
                          "5.6.0" );
+            server()->discardBody();
             finish();
         }
     }
@@ -551,11 +580,14 @@ class SmtpBdatData
 {
 public:
     SmtpBdatData()
-        : size( 0 ), read( false ), last( false ) {}
+        : size( 0 ), read( false ), last( false ), spool( 0 ),
+          appended( false ) {}
     uint size;
     bool read;
     EString chunk;
     bool last;
+    SpoolFile * spool;
+    bool appended;
 };
 
 
@@ -588,10 +620,26 @@ void SmtpBdat::execute()
 {
     if ( !d->read ) {
         Buffer * r = server()->readBuffer();
-        if ( r->size() < d->size )
-            return;
-        d->chunk = r->string( d->size );
-        r->remove( d->size );
+        if ( SpoolFile::enabled() && d->size > SpoolFile::threshold() ) {
+            // large chunks go to disk as they arrive
+            if ( !d->spool ) {
+                d->spool = new SpoolFile;
+                server()->setSpoolFile( d->spool );
+            }
+            uint n = d->size - d->spool->size();
+            if ( n > r->size() )
+                n = r->size();
+            d->spool->append( r->string( n ) );
+            r->remove( n );
+            if ( d->spool->size() < d->size )
+                return;
+        }
+        else {
+            if ( r->size() < d->size )
+                return;
+            d->chunk = r->string( d->size );
+            r->remove( d->size );
+        }
         server()->setInputState( SMTP::Command );
         d->read = true;
     }
@@ -599,9 +647,19 @@ void SmtpBdat::execute()
     if ( !server()->isFirstCommand( this ) )
         return;
 
-    EString b = server()->body();
-    b.append( d->chunk );
-    server()->setBody( b );
+    // SmtpData::execute() may run this function again later (e.g. when
+    // the injector is done), so we take care to append only once.
+    if ( !d->appended ) {
+        d->appended = true;
+        if ( d->spool ) {
+            // the body adopts the spooled chunk rather than copying it
+            server()->appendBody( d->spool );
+            server()->setSpoolFile( 0 );
+        }
+        else {
+            server()->appendBody( d->chunk );
+        }
+    }
     if ( d->last ) {
         SmtpData::execute();
     }
@@ -616,11 +674,13 @@ class SmtpBurlData
     : public Garbage
 {
 public:
-    SmtpBurlData() : last( false ), url( 0 ), fetcher( 0 ) {}
+    SmtpBurlData()
+        : last( false ), url( 0 ), fetcher( 0 ), appended( false ) {}
 
     bool last;
     ImapUrl * url;
     ImapUrlFetcher * fetcher;
+    bool appended;
 };
 
 
@@ -681,15 +741,18 @@ void SmtpBurl::execute()
     if ( d->fetcher->failed() ) {
         respond( 554, "URL resolution problem: " + d->fetcher->error(),
                  "5.5.0" );
+        server()->discardBody();
         finish();
         return;
     }
     if ( !server()->isFirstCommand( this ) )
         return;
 
-    EString b( server()->body() );
-    b.append( d->url->text() );
-    server()->setBody( b );
+    // as for BDAT, this may be executed again, but must append once
+    if ( !d->appended ) {
+        d->appended = true;
+        server()->appendBody( d->url->text() );
+    }
     if ( d->last ) {
         SmtpData::execute();
     }
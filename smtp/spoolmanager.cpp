@@ -2,6 +2,7 @@
 
 #include "spoolmanager.h"
 
+#include "map.h"
 #include "query.h"
 #include "timer.h"
 #include "mailbox.h"
@@ -15,6 +16,8 @@
 #include "allocator.h"
 #include "scope.h"
 
+#include <time.h> // time(0)
+
 #define SPOOLINTERVAL    900
 #define SSPOOLINTERVAL  "900"  /* Keep this in sync with SPOOLINTERVAL */
 
@@ -23,25 +26,55 @@ static SpoolManager * sm;
 static bool shutdown;
 
 
+class SpoolEntry
+    : public Garbage
+{
+public:
+    SpoolEntry( uint m, uint a ): Garbage(), message( m ), at( a ) {}
+
+    uint message;
+    uint at;
+};
+
+
 class SpoolManagerData
     : public Garbage
 {
 public:
     SpoolManagerData()
-        : q( 0 ), t( 0 ), again( false )
+        : q( 0 ), t( 0 ), again( false ), full( false ),
+          reloaded( 0 )
     {}
 
     Query * q;
     Timer * t;
     List<DeliveryAgent> agents;
     bool again;
+    bool full;
+
+    List<SpoolEntry> queue;
+    Map<SpoolEntry> queued;
+    uint reloaded;
 };
 
 
 /*! \class SpoolManager spoolmanager.h
 
-    This class periodically attempts to deliver mail from the
-    deliveries table to a smarthost using DeliveryAgent.
+    This class attempts to deliver mail from the deliveries table to a
+    smarthost using DeliveryAgent.
+
+    The SpoolManager keeps a schedule of spooled messages in RAM,
+    ordered by the time when each can next be attempted. The schedule
+    is loaded from the database at startup and every SPOOLINTERVAL
+    seconds (so that work done by other processes is noticed). In
+    between, a "deliveries_updated" notification causes only the
+    messages that are neither in the schedule nor being delivered to
+    be read.
+
+    At most smarthost-connections DeliveryAgent objects work at a
+    time, and SmtpClient::provide() lets each reuse an idle connection
+    to the smarthost, so a burst of outgoing mail is sent over a few
+    connections in parallel.
 
     Each archiveopteryx process has only one instance of this class,
     which is created by SpoolManager::setup().
@@ -63,95 +96,196 @@ SpoolManager::SpoolManager()
                            0 );
     q->bind( 1, Recipient::Unknown );
     q->bind( 2, Recipient::Delayed );
+    q->setPriority( Query::Background );
     q->execute();
 }
 
 
 void SpoolManager::execute()
 {
-    // Fetch a list of spooled messages, and the next time we can try
-    // to deliver each of them.
+    Scope x( log() );
 
-    uint delay = UINT_MAX;
+    uint now = (uint)time( 0 );
 
-    if ( !d->q ) {
-        IntegerSet have;
-        List<DeliveryAgent>::Iterator a( d->agents );
-        while ( a ) {
-            if ( a->working() ) {
-                have.add( a->messageId() );
-                delay = SPOOLINTERVAL;
-                ++a;
-            }
-            else {
-                d->agents.take( a );
-            }
-        }
+    // Retire the agents which have finished, and reschedule their
+    // messages if they must be tried again.
 
-        log( "Starting queue run" );
-        d->again = false;
-        reset();
-        EString s( "select d.message, "
-                   "extract(epoch from"
-                   " min(coalesce(dr.last_attempt+interval '"
-                   SSPOOLINTERVAL " s',"
-                   " d.deliver_after,"
-                   " current_timestamp)))::bigint"
-                   "-extract(epoch from current_timestamp)::bigint as delay "
-                   "from deliveries d "
-                   "join delivery_recipients dr on (d.id=dr.delivery) "
-                   "where (dr.action=$1 or dr.action=$2) " );
-        if ( !have.isEmpty() )
-            s.append( "and not d.message=any($3) " );
-        s.append( "group by d.message "
-                  "order by delay" );
-        d->q = new Query( s, this );
-        d->q->bind( 1, Recipient::Unknown );
-        d->q->bind( 2, Recipient::Delayed );
-        if ( !have.isEmpty() )
-            d->q->bind( 3, have );
-        d->q->execute();
+    List<DeliveryAgent>::Iterator a( d->agents );
+    while ( a ) {
+        if ( a->working() ) {
+            ++a;
+        }
+        else {
+            if ( a->retry() )
+                schedule( a->messageId(), now + SPOOLINTERVAL );
+            d->agents.take( a );
+        }
     }
 
-    if ( d->q && !d->q->done() )
-        return;
-
-    // Is there anything we might do?
+    // Read the spool, if there's reason to.
 
-    if ( d->q && !d->q->rows() ) {
-        // No. Just finish.
-        reset();
-        log( "Ending queue run" );
-        return;
+    if ( !d->q ) {
+        if ( d->reloaded + SPOOLINTERVAL <= now )
+            load( true );
+        else if ( d->again )
+            load( false );
     }
 
-    // Yes. What?
-
     if ( d->q ) {
+        if ( !d->q->done() )
+            return;
+
+        if ( d->full ) {
+            d->queue.clear();
+            d->queued.clear();
+        }
+
         while ( d->q->hasResults() ) {
             Row * r = d->q->nextRow();
-            int64 deliverableAt = r->getBigint( "delay" );
-            if ( deliverableAt <= 0 ) {
-                DeliveryAgent * a
-                    = new DeliveryAgent( r->getInt( "message" ) );
-                (void)new Timer( a, d->agents.count() * 5 );
-                d->agents.append( a );
-            }
-            else if ( delay > deliverableAt )
-                delay = deliverableAt;
-        }
-        if ( delay < UINT_MAX ) {
-            log( "Will process the queue again in " +
-                 fn( delay ) + " seconds" );
-            d->t = new Timer( this, delay );
+            int64 delay = r->getBigint( "delay" );
+            if ( delay < 0 )
+                delay = 0;
+            schedule( r->getInt( "message" ), now + (uint)delay );
         }
+
+        if ( d->q->failed() )
+            log( "Could not read the spool: " + d->q->error(), Log::Error );
+        else if ( d->full )
+            log( "Spool contains " + fn( d->queue.count() ) +
+                 " messages", Log::Debug );
         d->q = 0;
     }
 
+    dispatch();
     reset();
 }
 
 
+/*! Records that \a message should be attempted at \a at (a unix
+    time). If it's already in the schedule, the earlier of the two
+    times is used.
+*/
+
+void SpoolManager::schedule( uint message, uint at )
+{
+    SpoolEntry * e = d->queued.find( message );
+    if ( e ) {
+        if ( e->at <= at )
+            return;
+        d->queue.remove( e );
+        e->at = at;
+    }
+    else {
+        e = new SpoolEntry( message, at );
+        d->queued.insert( message, e );
+    }
+
+    // the schedule is short and mostly appended to, so we search
+    // from the end.
+    List<SpoolEntry>::Iterator i( d->queue.last() );
+    while ( i && i->at > at )
+        --i;
+    if ( i )
+        d->queue.insert( ++i, e );
+    else
+        d->queue.prepend( e );
+}
+
+
+/*! Starts reading the spool. If \a full is true, the schedule is
+    rebuilt from scratch, otherwise only messages which aren't already
+    in the schedule are read.
+
+    Rows in the deliveries table may be committed out of id order, so
+    we can't just look for ids above the highest one seen so far.
+*/
+
+void SpoolManager::load( bool full )
+{
+    uint now = (uint)time( 0 );
+
+    d->again = false;
+    d->full = full;
+    if ( full )
+        d->reloaded = now;
+
+    IntegerSet have;
+    List<DeliveryAgent>::Iterator a( d->agents );
+    while ( a ) {
+        have.add( a->messageId() );
+        ++a;
+    }
+    if ( !full ) {
+        List<SpoolEntry>::Iterator e( d->queue );
+        while ( e ) {
+            have.add( e->message );
+            ++e;
+        }
+    }
+
+    EString s( "select d.message, "
+               "extract(epoch from"
+               " min(coalesce(dr.last_attempt+interval '"
+               SSPOOLINTERVAL " s',"
+               " d.deliver_after,"
+               " current_timestamp)))::bigint"
+               "-extract(epoch from current_timestamp)::bigint as delay "
+               "from deliveries d "
+               "join delivery_recipients dr on (d.id=dr.delivery) "
+               "where (dr.action=$1 or dr.action=$2) " );
+    if ( !have.isEmpty() )
+        s.append( "and not d.message=any($3) " );
+    s.append( "group by d.message" );
+
+    d->q = new Query( s, this );
+    d->q->setPriority( Query::Background );
+    d->q->bind( 1, Recipient::Unknown );
+    d->q->bind( 2, Recipient::Delayed );
+    if ( !have.isEmpty() )
+        d->q->bind( 3, have );
+    d->q->execute();
+
+    if ( full )
+        log( "Starting queue run" );
+}
+
+
+/*! Starts a DeliveryAgent for each message in the schedule that is
+    due now, as long as fewer than smarthost-connections agents are
+    working.
+*/
+
+void SpoolManager::dispatch()
+{
+    if ( ::shutdown )
+        return;
+
+    uint max = Configuration::scalar( Configuration::SmartHostConnections );
+    if ( max < 1 )
+        max = 1;
+    uint now = (uint)time( 0 );
+
+    while ( d->agents.count() < max &&
+            !d->queue.isEmpty() && d->queue.firstElement()->at <= now ) {
+        SpoolEntry * e = d->queue.shift();
+        d->queued.remove( e->message );
+
+        bool busy = false;
+        List<DeliveryAgent>::Iterator a( d->agents );
+        while ( a && !busy ) {
+            if ( a->messageId() == e->message )
+                busy = true;
+            ++a;
+        }
+        if ( !busy ) {
+            DeliveryAgent * agent = new DeliveryAgent( e->message, this );
+            d->agents.append( agent );
+            agent->execute();
+        }
+    }
+}
+
+
 /*! This function is called whenever a new row is added to the
     deliveries table, and updates the state machine so the message
     will be delivered soon.
@@ -159,32 +293,43 @@ void SpoolManager::execute()
 
 void SpoolManager::deliverNewMessage()
 {
+    d->again = true;
     if ( d->q ) {
-        d->again = true;
         log( "New message added to spool while spool is being processed",
              Log::Debug );
         return;
     }
-    else {
-        log( "New message added to spool; will deliver when possible" );
-        d->again = true;
-        reset();
-    }
+
+    log( "New message added to spool; will deliver when possible" );
+    execute();
 }
 
 
 
-/*! Resets the perishable state of this SpoolManager, i.e. all but the
-    Timer. Provided for convenience.
+/*! Sets the Timer to wake this SpoolManager when the next message in
+    the schedule is due, or when the spool should be reloaded,
+    whichever comes first. Provided for convenience.
 */
 
 void SpoolManager::reset()
 {
     delete d->t;
     d->t = 0;
+    if ( ::shutdown )
+        return;
+
+    uint now = (uint)time( 0 );
+    uint next = d->reloaded + SPOOLINTERVAL;
     if ( d->again )
-        d->t = new Timer( this, 1 );
-    d->q = 0;
+        next = now + 1;
+    if ( !d->queue.isEmpty() &&
+         d->agents.count() <
+         Configuration::scalar( Configuration::SmartHostConnections ) &&
+         d->queue.firstElement()->at < next )
+        next = d->queue.firstElement()->at;
+    if ( next <= now )
+        next = now + 1;
+    d->t = new Timer( this, next - now );
 }
 
 
@@ -21,6 +21,10 @@ public:
 
 private:
     class SpoolManagerData * d;
+
+    void schedule( uint, uint );
+    void load( bool );
+    void dispatch();
     void reset();
 };
 